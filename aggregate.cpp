@@ -0,0 +1,198 @@
+#include <unistd.h>  /* UNIX standard function definitions */
+#include <string.h>  /* Used for memory copies */
+#include <termios.h> /* tcflush */
+#include <poll.h>
+
+#include "aggregate.h"
+#include "log.h"
+
+/******************************************************************************
+ * Gets the space a packet takes up in a super-frame. Private.
+ *
+ * @param     size    The size of the packet
+ *
+ * @return    The size of the length prefix, packet and padding
+ *****************************************************************************/
+int aggregate_space(int size)
+{
+	return sizeof(uint16_t) + ((size + 1) & ~1);
+}
+
+/******************************************************************************
+ * Initializes an empty super-frame.
+ *
+ * @param     ag         The super-frame to initialize
+ * @param     fd         The file descriptor to the radio device
+ * @param     max_size   Largest super-frame to send (At most AGGREGATE_MAX_SIZE)
+ *****************************************************************************/
+void aggregate_init(struct aggregate* ag, int fd, int max_size)
+{
+	memset(ag, 0, sizeof(*ag));
+	ag->fd = fd;
+	ag->max_size = max_size < AGGREGATE_MAX_SIZE ? max_size : AGGREGATE_MAX_SIZE;
+	ag->len = sizeof(struct aggregate_header);
+}
+
+/******************************************************************************
+ * Checks if a packet still fits in the super-frame.
+ *
+ * @param     ag      The super-frame
+ * @param     size    The size of the packet
+ *
+ * @return    If the packet fits
+ *****************************************************************************/
+int aggregate_fits(struct aggregate* ag, int size)
+{
+	return ag->len + aggregate_space(size) <= ag->max_size;
+}
+
+/******************************************************************************
+ * Adds a packet to the super-frame. When the packet does not fit, the packets
+ * already queued are sent first. Sending the super-frame before it is full is
+ * left to the caller.
+ *
+ * @param     ag      The super-frame
+ * @param     packet  The packet to add
+ * @param     size    The size of the packet
+ *
+ * @return    If the packet was queued (0 = success, -1 = failure)
+ *****************************************************************************/
+int aggregate_queue(struct aggregate* ag, uint8_t* packet, int size)
+{
+	struct aggregate_header* header = (struct aggregate_header*) ag->buf;
+	uint16_t length = size;
+
+	if(!aggregate_fits(ag, size))
+	{
+		if(header->count == 0 || aggregate_flush(ag) != 0 || !aggregate_fits(ag, size))
+		{
+			log("Packet Does Not Fit in Super-Frame (%d Bytes).\n", size);
+			return -1;
+		}
+	}
+
+	// Length prefix, packet and padding
+	memcpy(ag->buf + ag->len, &length, sizeof(length));
+	memcpy(ag->buf + ag->len + sizeof(length), packet, size);
+	if(size & 1) ag->buf[ag->len + sizeof(length) + size] = 0;
+
+	ag->len += aggregate_space(size);
+	header->count++;
+	return 0;
+}
+
+/******************************************************************************
+ * Sends all queued packets as one super-frame with a single write.
+ *
+ * @param     ag      The super-frame
+ *
+ * @return    If the super-frame was sent (0 = success, -1 = failure)
+ *****************************************************************************/
+int aggregate_flush(struct aggregate* ag)
+{
+	struct aggregate_header* header = (struct aggregate_header*) ag->buf;
+
+	if(header->count == 0) return 0;
+
+	header->magic = AGGREGATE_MAGIC;
+	header->size = ag->len - sizeof(struct aggregate_header);
+
+	int n = write(ag->fd, ag->buf, ag->len);
+	log("Wrote super-frame - %d packets (%d Bytes).\n", header->count, n);
+
+	int status = n == ag->len ? 0 : -1;
+
+	// Start a new super-frame
+	memset(header, 0, sizeof(*header));
+	ag->len = sizeof(struct aggregate_header);
+	return status;
+}
+
+/******************************************************************************
+ * Reads an exact number of bytes, giving up if the data stops coming.
+ * Private.
+ *
+ * @param     fd      The file descriptor to the radio device
+ * @param     buf     The buffer to fill
+ * @param     size    The number of bytes to read
+ *
+ * @return    If the read was successful (1 = success, 0 = timeout, -1 = error)
+ *****************************************************************************/
+int aggregate_read_full(int fd, uint8_t* buf, int size)
+{
+	int poll_timeout = 100; // Amount of time to wait before giving up
+	int total = 0;
+
+	while(total < size)
+	{
+		struct pollfd pfd = {fd, POLLIN | POLLPRI, 0};
+		if(poll(&pfd, 1, poll_timeout) <= 0) return 0;
+
+		int n = read(fd, buf + total, size - total);
+		if(n <= 0) return -1; // Device closed or read error
+		total += n;
+	}
+
+	return 1;
+}
+
+/******************************************************************************
+ * Waits for a super-frame and reads all of it into a buffer.
+ *
+ * @param     fd       The file descriptor to the radio device
+ * @param     buf      The buffer to fill (AGGREGATE_MAX_SIZE bytes)
+ * @param     timeout  The amount of time to wait in milliseconds (-1 = forever)
+ *
+ * @return    The size of the super-frame (0 = nothing valid recieved, -1 = error)
+ *****************************************************************************/
+int aggregate_read(int fd, uint8_t* buf, int timeout)
+{
+	struct aggregate_header* header = (struct aggregate_header*) buf;
+	struct pollfd pfd = {fd, POLLIN | POLLPRI, 0};
+	int n;
+
+	if(poll(&pfd, 1, timeout) <= 0) return 0;
+
+	n = aggregate_read_full(fd, buf, sizeof(struct aggregate_header));
+	if(n <= 0) return n;
+
+	// Drop whatever is buffered when the header makes no sense to resynchronize
+	if(header->magic != AGGREGATE_MAGIC || header->size > AGGREGATE_MAX_SIZE - sizeof(struct aggregate_header))
+	{
+		log("Invalid Super-Frame Header.\n");
+		tcflush(fd, TCIFLUSH);
+		return 0;
+	}
+
+	n = aggregate_read_full(fd, buf + sizeof(struct aggregate_header), header->size);
+	if(n <= 0) return n;
+
+	return sizeof(struct aggregate_header) + header->size;
+}
+
+/******************************************************************************
+ * Steps through the packets of a super-frame in place. Start with offset 0
+ * and call until NULL is returned.
+ *
+ * @param     buf     The super-frame
+ * @param     len     The size of the super-frame
+ * @param     offset  The position in the super-frame, advanced on return
+ * @param     size    Set to the size of the packet
+ *
+ * @return    The next packet (NULL when there are no more)
+ *****************************************************************************/
+uint8_t* aggregate_next(uint8_t* buf, int len, int* offset, int* size)
+{
+	uint16_t length;
+
+	if(*offset == 0) *offset = sizeof(struct aggregate_header);
+	if(*offset + (int) sizeof(length) > len) return NULL;
+
+	memcpy(&length, buf + *offset, sizeof(length));
+	if(*offset + (int) sizeof(length) + length > len) return NULL;
+
+	uint8_t* packet = buf + *offset + sizeof(length);
+	*offset += aggregate_space(length);
+	*size = length;
+	return packet;
+}
@@ -0,0 +1,44 @@
+/******************************************************************************
+ * File: aggregate.h
+ *
+ * Description: Describes frame aggregation, which packs several ITP packets
+ *              into one length prefixed super-frame sent with a single write
+ *****************************************************************************/
+#pragma once
+#include <stdint.h>
+
+#define AGGREGATE_MAGIC      0xA5 // Marks the start of a super-frame
+#define AGGREGATE_MAX_SIZE   256  // Largest super-frame in bytes
+#define AGGREGATE_MAX_DELAY  5    // Longest time to hold a super-frame for more packets in milliseconds
+
+/******************************************************************************
+ * Super-frame header. It is followed by count packets, each prefixed by its
+ * uint16_t length and padded to an even length so every packet is aligned.
+ *****************************************************************************/
+struct aggregate_header
+{
+	uint8_t   magic;  // Always AGGREGATE_MAGIC
+	uint8_t   count;  // Number of packets in the super-frame
+	uint16_t  size;   // Bytes following the header
+};
+
+/******************************************************************************
+ * Packets waiting to be sent as one super-frame
+ *****************************************************************************/
+struct aggregate
+{
+	int       fd;                        // The file descriptor to the radio device
+	int       max_size;                  // Largest super-frame to send
+	uint8_t   buf[AGGREGATE_MAX_SIZE];   // The super-frame being built
+	int       len;                       // Bytes used in the super-frame
+};
+
+/******************************************************************************
+ * Aggregation functions
+ *****************************************************************************/
+void aggregate_init(struct aggregate* ag, int fd, int max_size);
+int aggregate_fits(struct aggregate* ag, int size);
+int aggregate_queue(struct aggregate* ag, uint8_t* packet, int size);
+int aggregate_flush(struct aggregate* ag);
+int aggregate_read(int fd, uint8_t* buf, int timeout);
+uint8_t* aggregate_next(uint8_t* buf, int len, int* offset, int* size);
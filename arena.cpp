@@ -0,0 +1,217 @@
+#include <stdlib.h>  /* Memory allocation */
+#include <stddef.h>  /* offsetof */
+#include <string.h>  /* Used for memory copies */
+#include <pthread.h> /* Threads for large arenas */
+
+#include "packet.h"
+#include "radio.h"
+#include "arena.h"
+#include "crc32c.h"
+#include "log.h"
+
+/******************************************************************************
+ * A range of packets for one thread to build. Private.
+ *****************************************************************************/
+struct arena_work
+{
+	struct arena*  arena;       // The arena being built
+	uint8_t*       data;        // The data being transferred
+	int            size;        // The size of the data
+	uint8_t        stream;      // The stream identifier of the transfer
+	uint8_t        generation;  // The generation of the transfer on its stream
+	int            first;       // The first packet to build
+	int            last;        // One past the last packet to build
+};
+
+/******************************************************************************
+ * Fills in a range of packets and generates their checksums in batches.
+ * Private.
+ *
+ * @param     arg     The arena_work describing the range
+ *
+ * @return    Unused
+ *****************************************************************************/
+void* arena_build_range(void* arg)
+{
+	struct arena_work* work = (struct arena_work*) arg;
+	struct arena* arena = work->arena;
+	struct packet* batch[ARENA_CRC_BATCH];
+	int batched = 0;
+
+	for(int i = work->first; i < work->last; i++)
+	{
+		struct packet* packet = (struct packet*) (arena->base + arena->offsets[i]);
+
+		// Ensure correct data size when at the end of data
+		int offset = i * MAX_DATA_SIZE;
+		int data_size = work->size - offset;
+		if(data_size > MAX_DATA_SIZE) data_size = MAX_DATA_SIZE;
+
+		packet->type = ITP_TYPE_DATA_SEND;
+		packet->stream = work->stream;
+		packet->seqnum = i;
+		packet->total = arena->count;
+		packet->size = data_size;
+		packet->ack = 0;
+		packet->ack_stream = 0;
+		packet->generation = work->generation;
+		memcpy(&packet->data, work->data + offset, data_size);
+
+		arena->sizes[i] = sizeof(struct packet) - 1 + data_size;
+
+		// Checksum full batches while the packets are still in cache
+		batch[batched++] = packet;
+		if(batched == ARENA_CRC_BATCH)
+		{
+			packet_generate_crc_batch(batch, batched);
+			batched = 0;
+		}
+	}
+
+	packet_generate_crc_batch(batch, batched);
+	return NULL;
+}
+
+/******************************************************************************
+ * Builds every data packet of a transfer into one contiguous, cache aligned
+ * arena so that sending and resending a packet is only a lookup. Large
+ * transfers are split across several threads. The final packet carries the
+ * CRC32C digest of the whole transfer.
+ *
+ * @param     arena       The arena to build
+ * @param     data        The data to send
+ * @param     size        The size of the data
+ * @param     stream      The stream identifier of the transfer
+ * @param     generation  The generation of the transfer on its stream
+ *
+ * @return    If the arena was built (0 = success, -1 = failure)
+ *****************************************************************************/
+int arena_build(struct arena* arena, uint8_t* data, int size, uint8_t stream, uint8_t generation)
+{
+	int stride = (sizeof(struct packet) - 1 + MAX_DATA_SIZE + ITP_DIGEST_SIZE + ARENA_FRAME_ALIGN - 1) & ~(ARENA_FRAME_ALIGN - 1);
+	int count = (size + MAX_DATA_SIZE - 1) / MAX_DATA_SIZE;
+	void* base = NULL;
+
+	memset(arena, 0, sizeof(*arena));
+
+	if(count > 0xFFFF)
+	{
+		log("Transfer Too Large (%d Bytes).\n", size);
+		return -1;
+	}
+
+	// Allocate the packet storage and index
+	if(posix_memalign(&base, ARENA_ALIGN, (size_t) stride * (count ? count : 1)) != 0)
+	{
+		log_error("Allocating packet arena");
+		return -1;
+	}
+	arena->base = (uint8_t*) base;
+
+	// Clear the storage so any padding sent with a packet is zero
+	memset(arena->base, 0, (size_t) stride * (count ? count : 1));
+
+	arena->offsets = (uint32_t*) malloc(sizeof(uint32_t) * (count ? count : 1));
+	arena->sizes = (uint16_t*) malloc(sizeof(uint16_t) * (count ? count : 1));
+	arena->count = count;
+
+	if(arena->offsets == NULL || arena->sizes == NULL)
+	{
+		log_error("Allocating packet arena");
+		arena_free(arena);
+		return -1;
+	}
+
+	for(int i = 0; i < count; i++)
+	{
+		arena->offsets[i] = i * stride;
+	}
+
+	// Split large transfers across threads
+	int threads = count / ARENA_THREAD_FRAMES;
+	if(threads > ARENA_MAX_THREADS) threads = ARENA_MAX_THREADS;
+	if(threads < 1) threads = 1;
+
+	struct arena_work work[ARENA_MAX_THREADS];
+	pthread_t ids[ARENA_MAX_THREADS];
+	int started = 0;
+
+	for(int t = 0; t < threads; t++)
+	{
+		work[t].arena = arena;
+		work[t].data = data;
+		work[t].size = size;
+		work[t].stream = stream;
+		work[t].generation = generation;
+		work[t].first = count * t / threads;
+		work[t].last = count * (t + 1) / threads;
+	}
+
+	// Build the checksum table before any threads use it
+	packet_generate_crc_batch(NULL, 0);
+
+	// The calling thread always builds the first range
+	for(int t = 1; t < threads; t++)
+	{
+		if(pthread_create(&ids[t], NULL, arena_build_range, &work[t]) != 0)
+		{
+			break;
+		}
+		started = t;
+	}
+
+	arena_build_range(&work[0]);
+
+	// Build any ranges a thread could not be started for
+	for(int t = started + 1; t < threads; t++)
+	{
+		arena_build_range(&work[t]);
+	}
+	for(int t = 1; t <= started; t++)
+	{
+		pthread_join(ids[t], NULL);
+	}
+
+	// The final packet carries the digest of the whole transfer
+	if(count > 0)
+	{
+		struct packet* packet = (struct packet*) (arena->base + arena->offsets[count - 1]);
+		uint32_t digest = crc32c_update(0, data, size);
+
+		memcpy((uint8_t*) packet + offsetof(struct packet, data) + packet->size, &digest, ITP_DIGEST_SIZE);
+		packet->type |= ITP_FLAG_DIGEST;
+		packet->size += ITP_DIGEST_SIZE;
+		packet->crc = packet_generate_crc(packet);
+		arena->sizes[count - 1] += ITP_DIGEST_SIZE;
+	}
+
+	return 0;
+}
+
+/******************************************************************************
+ * Looks up a packet in an arena.
+ *
+ * @param     arena   The arena to look in
+ * @param     seqnum  The sequence number of the packet
+ * @param     size    Set to the size of the packet
+ *
+ * @return    The packet
+ *****************************************************************************/
+uint8_t* arena_frame(struct arena* arena, uint16_t seqnum, int* size)
+{
+	*size = arena->sizes[seqnum];
+	return arena->base + arena->offsets[seqnum];
+}
+
+/******************************************************************************
+ * Releases the memory held by an arena.
+ *
+ * @param     arena   The arena to release
+ *****************************************************************************/
+void arena_free(struct arena* arena)
+{
+	free(arena->base);
+	free(arena->offsets);
+	free(arena->sizes);
+	memset(arena, 0, sizeof(*arena));
+}
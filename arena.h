@@ -0,0 +1,32 @@
+/******************************************************************************
+ * File: arena.h
+ *
+ * Description: Describes the packet arena which holds every data packet of a
+ *              transfer, built and checksummed once before sending
+ *****************************************************************************/
+#pragma once
+#include <stdint.h>
+
+#define ARENA_ALIGN         64   // Alignment of the arena (cache line size)
+#define ARENA_FRAME_ALIGN   32   // Alignment of each packet in the arena
+#define ARENA_CRC_BATCH     64   // Packets checksummed per batch
+#define ARENA_MAX_THREADS   4    // Most threads used to build an arena
+#define ARENA_THREAD_FRAMES 4096 // Fewest packets worth a thread of their own
+
+/******************************************************************************
+ * Every data packet of a transfer stored contiguously
+ *****************************************************************************/
+struct arena
+{
+	uint8_t*   base;     // The packet storage
+	uint32_t*  offsets;  // Offset of every packet in the storage
+	uint16_t*  sizes;    // Size of every packet
+	uint16_t   count;    // Number of packets
+};
+
+/******************************************************************************
+ * Arena functions
+ *****************************************************************************/
+int arena_build(struct arena* arena, uint8_t* data, int size, uint8_t stream, uint8_t generation);
+uint8_t* arena_frame(struct arena* arena, uint16_t seqnum, int* size);
+void arena_free(struct arena* arena);
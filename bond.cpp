@@ -0,0 +1,507 @@
+#include <unistd.h>  /* UNIX standard function definitions */
+#include <stdlib.h>  /* Memory allocation */
+#include <string.h>  /* Used for memory copies */
+#include <poll.h>
+
+#include "packet.h"
+#include "radio.h"
+#include "arena.h"
+#include "bond.h"
+#include "crc32c.h"
+#include "log.h"
+
+/******************************************************************************
+ * Data chunk states
+ *****************************************************************************/
+#define BOND_CHUNK_PENDING  0 // Data chunk still needs to be sent
+#define BOND_CHUNK_INFLIGHT 1 // Data chunk is waiting for an ACK
+#define BOND_CHUNK_ACKED    2 // Data chunk was recieved successfully
+
+/******************************************************************************
+ * Initializes an empty bonded link.
+ *
+ * @param     bond    The bonded link
+ *****************************************************************************/
+void bond_init(struct bond* bond)
+{
+	memset(bond, 0, sizeof(*bond));
+}
+
+/******************************************************************************
+ * Adds an already open file descriptor to a bonded link. This is used for
+ * simulated radio devices as well as real ones.
+ *
+ * @param     bond    The bonded link
+ * @param     fd      The file descriptor to the radio device
+ *
+ * @return    If the device was added (0 = success, -1 = bond is full)
+ *****************************************************************************/
+int bond_add(struct bond* bond, int fd)
+{
+	if(bond->count == BOND_MAX_LINKS)
+	{
+		log("Bond Full. Radio Device Not Added.\n");
+		return -1;
+	}
+
+	struct bond_link* link = &bond->links[bond->count++];
+	memset(link, 0, sizeof(*link));
+	link->fd = fd;
+
+	return 0;
+}
+
+/******************************************************************************
+ * Opens and configures several radio devices as one bonded link.
+ *
+ * @param     bond     The bonded link to initialize
+ * @param     devices  The radio device names
+ * @param     count    The number of radio devices
+ * @param     baud     The baud rate to set the serial outputs to
+ *
+ * @return    The number of radio devices in the bond
+ *****************************************************************************/
+int bond_open(struct bond* bond, const char** devices, int count, int baud)
+{
+	bond_init(bond);
+
+	for(int i = 0; i < count; i++)
+	{
+		int fd = radio_open(devices[i]);
+		radio_config(fd, baud);
+		bond_add(bond, fd);
+	}
+
+	log("Bond Opened (%d Radio Devices).\n", bond->count);
+	return bond->count;
+}
+
+/******************************************************************************
+ * Estimates when a link would finish sending one more data chunk if it were
+ * given one now. Links that have not been measured yet are assumed to be
+ * fast so that they get a chance to be measured, unless they are busy or
+ * have already timed out, in which case they are assumed to take the full
+ * ACK timeout. Private.
+ *
+ * @param     link    The link to estimate
+ * @param     now     The current time in microseconds
+ * @param     bytes   The size of the data chunk
+ *
+ * @return    The estimated completion time in microseconds
+ *****************************************************************************/
+uint64_t bond_link_finish(struct bond_link* link, uint64_t now, int bytes)
+{
+	uint64_t timeout = BOND_TIMEOUT_MS * 1000;
+
+	// Dropped links and links that are overdue never finish
+	if(link->timeouts >= BOND_MAX_TIMEOUTS) return UINT64_MAX;
+	if(link->busy && now >= link->sent + timeout) return UINT64_MAX;
+
+	uint64_t chunk_time;
+	if(link->throughput > 0)
+	{
+		chunk_time = (uint64_t) (bytes * 1000000.0 / link->throughput);
+	}
+	else if(link->busy || link->timeouts > 0)
+	{
+		chunk_time = timeout;
+	}
+	else
+	{
+		return now;
+	}
+
+	// Every timeout in a row makes the link look slower
+	chunk_time <<= link->timeouts;
+
+	uint64_t start = now;
+
+	// A busy link first has to finish its current chunk
+	if(link->busy && link->sent + chunk_time > now)
+	{
+		start = link->sent + chunk_time;
+	}
+
+	return start + chunk_time;
+}
+
+/******************************************************************************
+ * Sends a data chunk over one link of the bond without waiting for the ACK.
+ * Private.
+ *
+ * @param     link    The link to send over
+ * @param     arena   Every data packet of the transfer
+ * @param     seqnum  The data chunk to send
+ *****************************************************************************/
+void bond_link_send(struct bond_link* link, struct arena* arena, uint16_t seqnum)
+{
+	int packet_size;
+	uint8_t* packet = arena_frame(arena, seqnum, &packet_size);
+
+	int n = write(link->fd, packet, packet_size);
+	log("Wrote data chunk - %d of %d on fd %d (%d Bytes).\n", seqnum+1, arena->count, link->fd, n);
+
+	// A failed write is retried once the ACK times out
+	link->busy = 1;
+	link->seqnum = seqnum;
+	link->sent = log_time_us();
+}
+
+/******************************************************************************
+ * Writes a data buffer striped across all links of the bond. Every link has
+ * one data chunk in flight at a time and is handed the next chunk as soon as
+ * its ACK arrives, so each link carries chunks in proportion to its measured
+ * throughput. Near the end of the transfer a slow link is skipped when a
+ * faster link would finish the remaining chunks sooner. A link whose ACKs
+ * time out BOND_MAX_TIMEOUTS times in a row is dropped for the rest of the
+ * transfer.
+ *
+ * @param     bond    The bonded link
+ * @param     data    The data to send
+ * @param     size    The size of the data to send
+ *
+ * @return    If transfer was successful (0 = success, -1 = failure)
+ *****************************************************************************/
+int bond_data_send(struct bond* bond, uint8_t* data, int size)
+{
+	uint8_t read_buf[MAX_BUFFER_SIZE] = {0};
+	struct packet* packet = (struct packet*) read_buf;
+
+	// Build every packet up front so resends do not rebuild them
+	struct arena arena;
+	if(arena_build(&arena, data, size, 0, 0) != 0)
+	{
+		return -1;
+	}
+
+	// Determine sizing
+	uint16_t total = arena.count;
+	int packet_bytes = sizeof(struct packet) - 1 + MAX_DATA_SIZE;
+	int acked = 0;    // Data chunks that were recieved
+	int inflight = 0; // Data chunks waiting for an ACK
+	int cursor = 0;   // Lowest data chunk that may still be pending
+
+	uint8_t* state = (uint8_t*) calloc(total, 1);
+	if(state == NULL)
+	{
+		log_error("Allocating chunk state");
+		arena_free(&arena);
+		return -1;
+	}
+
+	for(int i = 0; i < bond->count; i++)
+	{
+		bond->links[i].busy = 0;
+		bond->links[i].chunks = 0;
+		bond->links[i].timeouts = 0;
+	}
+
+	log("Starting bonded packet writing (%d Links)...\n", bond->count);
+	while(acked < total)
+	{
+		uint64_t now = log_time_us();
+
+		// Order the links fastest first
+		int order[BOND_MAX_LINKS];
+		for(int i = 0; i < bond->count; i++)
+		{
+			int j = i;
+			while(j > 0 && bond->links[order[j-1]].throughput < bond->links[i].throughput)
+			{
+				order[j] = order[j-1];
+				j--;
+			}
+			order[j] = i;
+		}
+
+		// Give up once every link has been dropped
+		int alive = 0;
+		for(int i = 0; i < bond->count; i++)
+		{
+			if(bond->links[i].timeouts < BOND_MAX_TIMEOUTS) alive++;
+		}
+		if(alive == 0)
+		{
+			log("All Links Dropped. Exiting.\n");
+			free(state);
+			arena_free(&arena);
+			return -1;
+		}
+
+		// Hand the next pending data chunk to every idle link
+		for(int k = 0; k < bond->count; k++)
+		{
+			struct bond_link* link = &bond->links[order[k]];
+			int pending = total - acked - inflight;
+
+			if(link->busy || link->timeouts >= BOND_MAX_TIMEOUTS) continue;
+			if(pending == 0) break;
+
+			// Leave the last chunks to links that will finish them sooner
+			if(pending < alive)
+			{
+				uint64_t finish = bond_link_finish(link, now, packet_bytes);
+				int faster = 0;
+				for(int j = 0; j < bond->count; j++)
+				{
+					struct bond_link* other = &bond->links[j];
+					if(other != link && bond_link_finish(other, now, packet_bytes) < finish) faster = 1;
+				}
+				if(faster) continue;
+			}
+
+			while(state[cursor] != BOND_CHUNK_PENDING) cursor++;
+
+			state[cursor] = BOND_CHUNK_INFLIGHT;
+			inflight++;
+			bond_link_send(link, &arena, cursor);
+		}
+
+		// Wait for the earliest ACK or timeout
+		struct pollfd pfds[BOND_MAX_LINKS];
+		int timeout = BOND_TIMEOUT_MS;
+		for(int i = 0; i < bond->count; i++)
+		{
+			struct bond_link* link = &bond->links[i];
+			pfds[i].fd = link->busy ? link->fd : -1;
+			pfds[i].events = POLLIN | POLLPRI;
+			pfds[i].revents = 0;
+
+			if(link->busy)
+			{
+				int left = (int) (((int64_t) link->sent + BOND_TIMEOUT_MS * 1000 - (int64_t) now) / 1000);
+				if(left < 0) left = 0;
+				if(left < timeout) timeout = left;
+			}
+		}
+
+		if(poll(pfds, bond->count, timeout) == -1)
+		{
+			log_error("Poll failed");
+			free(state);
+			arena_free(&arena);
+			return -1;
+		}
+
+		now = log_time_us();
+		for(int i = 0; i < bond->count; i++)
+		{
+			struct bond_link* link = &bond->links[i];
+			if(!link->busy) continue;
+
+			// Give the data chunk back when the ACK does not arrive in time
+			if(!(pfds[i].revents & (POLLIN | POLLPRI)))
+			{
+				if(now >= link->sent + BOND_TIMEOUT_MS * 1000)
+				{
+					log("Warning: ACK timeout on fd %d.\n", link->fd);
+					state[link->seqnum] = BOND_CHUNK_PENDING;
+					if(link->seqnum < cursor) cursor = link->seqnum;
+					inflight--;
+					link->busy = 0;
+					link->throughput /= 2;
+
+					if(++link->timeouts == BOND_MAX_TIMEOUTS)
+					{
+						log("Warning: Dropping fd %d from the bond.\n", link->fd);
+					}
+				}
+				continue;
+			}
+
+			int n = radio_packet_receive(link->fd, read_buf, 0);
+
+			// Check that you got the correct number of bytes and correct checksum
+			if(packet_verify_format(packet, n) != 1)
+			{
+				log("Invalid Packet Recieved on fd %d (%d Bytes).\n", link->fd, n);
+				continue; // Wait for the timeout to resend
+			}
+
+			switch(packet->type)
+			{
+				case ITP_TYPE_DATA_ACK:
+					if(packet->seqnum != link->seqnum)
+					{
+						continue; // Stale ACK
+					}
+
+					// Update the measured throughput of the link
+					{
+						double elapsed = (now - link->sent) / 1000000.0;
+						if(elapsed <= 0) elapsed = 0.000001;
+						double sample = packet_bytes / elapsed;
+						link->throughput = link->throughput <= 0 ? sample : link->throughput * 0.75 + sample * 0.25;
+					}
+
+					state[link->seqnum] = BOND_CHUNK_ACKED;
+					acked++;
+					inflight--;
+					link->busy = 0;
+					link->chunks++;
+					link->timeouts = 0;
+					break;
+
+				case ITP_TYPE_DATA_NACK:
+					log("NACK Recieved on fd %d. Retry...\n", link->fd);
+					state[link->seqnum] = BOND_CHUNK_PENDING;
+					if(link->seqnum < cursor) cursor = link->seqnum;
+					inflight--;
+					link->busy = 0;
+					break;
+
+				case ITP_TYPE_DATA_ERR:
+					log("Error Recieved. Exiting.\n");
+					free(state);
+					arena_free(&arena);
+					return -1; // Irrecoverable
+
+				default:
+					log("Unknown Packet Type: 0x%X. Exiting.\n", packet->type);
+					free(state);
+					arena_free(&arena);
+					return -1; // Irrecoverable
+			}
+		}
+	}
+
+	for(int i = 0; i < bond->count; i++)
+	{
+		log("Link fd %d - %d chunks (%.0f B/s).\n", bond->links[i].fd, bond->links[i].chunks, bond->links[i].throughput);
+	}
+	log("Writing Complete.\n");
+
+	free(state);
+	arena_free(&arena);
+	return 0;
+}
+
+/******************************************************************************
+ * Read a transfer striped across all links of the bond. Data chunks may
+ * arrive in any order on any link and are placed by sequence number. The
+ * whole transfer is checked against its digest before the last ACK. A
+ * transfer that does not fit in the data buffer is refused with an error.
+ *
+ * @param     bond    The bonded link
+ * @param     data    The data buffer to fill
+ * @param     size    The size of the data buffer
+ *
+ * @return    The number of bytes recieved (-1 = links closed, too large or digest mismatch)
+ *****************************************************************************/
+int bond_data_receive(struct bond* bond, uint8_t* data, int size)
+{
+	// Allocate packet buffers
+	uint8_t write_buf[MAX_BUFFER_SIZE] = {0};
+	uint8_t read_buf[MAX_BUFFER_SIZE] = {0};
+	uint8_t final_buf[MAX_BUFFER_SIZE] = {0}; // The final packet, which carries the digest
+	struct packet* packet = (struct packet*) read_buf;
+
+	struct pollfd pfds[BOND_MAX_LINKS];
+	uint8_t* received = NULL; // Which data chunks were recieved
+	int count = 0;            // Number of data chunks recieved
+	int total = -1;           // Total data chunks
+	int len = 0;              // Number of bytes recieved
+	int open = bond->count;   // Number of links still open
+
+	for(int i = 0; i < bond->count; i++)
+	{
+		pfds[i].fd = bond->links[i].fd;
+		pfds[i].events = POLLIN | POLLPRI;
+		bond->links[i].chunks = 0;
+	}
+
+	log("Starting bonded packet reading (%d Links)...\n", bond->count);
+	while(count != total)
+	{
+		if(poll(pfds, bond->count, -1) == -1)
+		{
+			log_error("Poll failed");
+			free(received);
+			return -1;
+		}
+
+		for(int i = 0; i < bond->count; i++)
+		{
+			struct bond_link* link = &bond->links[i];
+			if(!(pfds[i].revents & (POLLIN | POLLPRI | POLLHUP))) continue;
+
+			int n = radio_packet_receive(link->fd, read_buf, 0);
+			if(n == -1)
+			{
+				log("Link fd %d Closed.\n", link->fd);
+				pfds[i].fd = -1;
+				if(--open == 0)
+				{
+					free(received);
+					return -1;
+				}
+				continue;
+			}
+
+			// Senders retransmit on their own, so bad packets are only dropped
+			if(packet_verify_format(packet, n) != 1 || (packet->type & ITP_TYPE_MASK) != ITP_TYPE_DATA_SEND)
+			{
+				log("Invalid Packet Recieved on fd %d (%d Bytes).\n", link->fd, n);
+				continue;
+			}
+
+			// Set the total packet number if it has not already been
+			if(total == -1)
+			{
+				total = packet->total;
+				received = (uint8_t*) calloc(total, 1);
+			}
+			if(packet->seqnum >= total) continue;
+
+			// Refuse the transfer instead of acknowledging data that is dropped
+			int offset = packet->seqnum * MAX_DATA_SIZE;
+			int data_size = packet_data_size(packet);
+			if((total - 1) * MAX_DATA_SIZE >= size || offset + data_size > size)
+			{
+				log("Transfer Too Large for Buffer (%d Bytes). Writing Error...\n", size);
+				int packet_size = packet_data_err_create(write_buf);
+				write(link->fd, write_buf, packet_size);
+				free(received);
+				return -1;
+			}
+
+			// Only add data to buffer if it is newer
+			if(!received[packet->seqnum])
+			{
+				memcpy(data + offset, &packet->data, data_size);
+				received[packet->seqnum] = 1;
+				len += data_size;
+				count++;
+				link->chunks++;
+
+				log("Read data chunk - %d of %d on fd %d (%d Bytes).\n", packet->seqnum+1, total, link->fd, n);
+
+				// The final packet carries the digest of the whole transfer
+				if(packet->seqnum == total - 1) memcpy(final_buf, packet, n);
+
+				// Chunks arrive out of order, so the digest is checked once at the end
+				if(count == total && !packet_digest_ok((struct packet*) final_buf, crc32c_update(0, data, len)))
+				{
+					log("Transfer Digest Mismatch. Writing Error...\n");
+					int packet_size = packet_data_err_create(write_buf);
+					write(link->fd, write_buf, packet_size);
+					free(received);
+					return -1;
+				}
+			}
+
+			// Sent acknowledgement over the link the chunk arrived on
+			int packet_size = packet_data_ack_create(write_buf, packet->seqnum, total);
+			write(link->fd, write_buf, packet_size);
+		}
+	}
+
+	for(int i = 0; i < bond->count; i++)
+	{
+		log("Link fd %d - %d chunks.\n", bond->links[i].fd, bond->links[i].chunks);
+	}
+	log("Reading Complete.\n");
+
+	free(received);
+	return len;
+}
@@ -0,0 +1,44 @@
+/******************************************************************************
+ * File: bond.h
+ *
+ * Description: Describes the bonded link which stripes a single transfer
+ *              across several radio devices
+ *****************************************************************************/
+#pragma once
+#include <stdint.h>
+
+#define BOND_MAX_LINKS    8
+#define BOND_TIMEOUT_MS   100
+#define BOND_MAX_TIMEOUTS 5   // ACK timeouts in a row before a link is dropped
+
+/******************************************************************************
+ * A single radio device that is part of a bonded link
+ *****************************************************************************/
+struct bond_link
+{
+	int       fd;          // The file descriptor to the radio device
+	double    throughput;  // Measured goodput in bytes per second (0 = unknown)
+	int       busy;        // If a data chunk is waiting for an ACK
+	uint16_t  seqnum;      // The data chunk waiting for an ACK
+	uint64_t  sent;        // When the data chunk was sent in microseconds
+	int       chunks;      // Data chunks delivered over this link
+	int       timeouts;    // ACK timeouts in a row (Dropped at BOND_MAX_TIMEOUTS)
+};
+
+/******************************************************************************
+ * Several radio devices used together as one link
+ *****************************************************************************/
+struct bond
+{
+	int               count;                  // Number of radio devices
+	struct bond_link  links[BOND_MAX_LINKS];  // The radio devices
+};
+
+/******************************************************************************
+ * Bond functions
+ *****************************************************************************/
+void bond_init(struct bond* bond);
+int bond_add(struct bond* bond, int fd);
+int bond_open(struct bond* bond, const char** devices, int count, int baud);
+int bond_data_send(struct bond* bond, uint8_t* data, int size);
+int bond_data_receive(struct bond* bond, uint8_t* data, int size);
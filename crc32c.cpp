@@ -0,0 +1,160 @@
+#include <string.h>  /* Used for memory copies */
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h> /* SSE4.2 CRC32 instructions */
+#endif
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>  /* ARMv8 CRC32 instructions */
+#endif
+
+#include "crc32c.h"
+
+#define CRC32C_POLY 0x82F63B78 // Reflected Castagnoli polynomial
+
+/******************************************************************************
+ * Updates a checksum one byte at a time using a lookup table. Used when the
+ * CPU has no CRC32C instructions. Private.
+ *
+ * @param     crc     The running checksum register (not inverted)
+ * @param     data    The data to add
+ * @param     size    The size of the data
+ *
+ * @return    The updated checksum register
+ *****************************************************************************/
+uint32_t crc32c_software(uint32_t crc, const uint8_t* data, int size)
+{
+	static uint32_t table[256];
+	static int ready = 0;
+
+	if(!ready)
+	{
+		for(uint32_t b = 0; b < 256; b++)
+		{
+			uint32_t c = b;
+			for(int i = 0; i < 8; i++)
+			{
+				c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+			}
+			table[b] = c;
+		}
+		ready = 1;
+	}
+
+	while(size-- > 0)
+	{
+		crc = (crc >> 8) ^ table[(crc ^ *data++) & 0xFF];
+	}
+
+	return crc;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/******************************************************************************
+ * Updates a checksum with the SSE4.2 CRC32 instruction, eight bytes at a
+ * time. Only called after checking that the CPU supports it. Private.
+ *
+ * @param     crc     The running checksum register (not inverted)
+ * @param     data    The data to add
+ * @param     size    The size of the data
+ *
+ * @return    The updated checksum register
+ *****************************************************************************/
+__attribute__((target("sse4.2")))
+uint32_t crc32c_sse42(uint32_t crc, const uint8_t* data, int size)
+{
+#if defined(__x86_64__)
+	uint64_t c = crc;
+	while(size >= 8)
+	{
+		uint64_t word;
+		memcpy(&word, data, 8);
+		c = _mm_crc32_u64(c, word);
+		data += 8;
+		size -= 8;
+	}
+	crc = (uint32_t) c;
+#endif
+	while(size >= 4)
+	{
+		uint32_t word;
+		memcpy(&word, data, 4);
+		crc = _mm_crc32_u32(crc, word);
+		data += 4;
+		size -= 4;
+	}
+	while(size-- > 0)
+	{
+		crc = _mm_crc32_u8(crc, *data++);
+	}
+	return crc;
+}
+#endif
+
+#if defined(__ARM_FEATURE_CRC32)
+/******************************************************************************
+ * Updates a checksum with the ARMv8 CRC32C instructions, eight bytes at a
+ * time. Private.
+ *
+ * @param     crc     The running checksum register (not inverted)
+ * @param     data    The data to add
+ * @param     size    The size of the data
+ *
+ * @return    The updated checksum register
+ *****************************************************************************/
+uint32_t crc32c_armv8(uint32_t crc, const uint8_t* data, int size)
+{
+	while(size >= 8)
+	{
+		uint64_t word;
+		memcpy(&word, data, 8);
+		crc = __crc32cd(crc, word);
+		data += 8;
+		size -= 8;
+	}
+	while(size-- > 0)
+	{
+		crc = __crc32cb(crc, *data++);
+	}
+	return crc;
+}
+#endif
+
+/******************************************************************************
+ * Adds data to a running CRC32C checksum. Start a new checksum with 0 and
+ * pass the previous result to continue it, so a transfer can be checksummed
+ * piece by piece as it arrives.
+ *
+ * @param     crc     The checksum so far (0 = new checksum)
+ * @param     data    The data to add
+ * @param     size    The size of the data
+ *
+ * @return    The updated checksum
+ *****************************************************************************/
+uint32_t crc32c_update(uint32_t crc, const uint8_t* data, int size)
+{
+	crc = ~crc;
+
+#if defined(__ARM_FEATURE_CRC32)
+	crc = crc32c_armv8(crc, data, size);
+#elif defined(__x86_64__) || defined(__i386__)
+	static int hardware = -1;
+	if(hardware == -1)
+	{
+		__builtin_cpu_init();
+		hardware = __builtin_cpu_supports("sse4.2") ? 1 : 0;
+	}
+
+	if(hardware)
+	{
+		crc = crc32c_sse42(crc, data, size);
+	}
+	else
+	{
+		crc = crc32c_software(crc, data, size);
+	}
+#else
+	crc = crc32c_software(crc, data, size);
+#endif
+
+	return ~crc;
+}
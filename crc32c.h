@@ -0,0 +1,13 @@
+/******************************************************************************
+ * File: crc32c.h
+ *
+ * Description: Describes the CRC32C (Castagnoli) checksum used to verify a
+ *              whole transfer, using the CPU CRC instructions when available
+ *****************************************************************************/
+#pragma once
+#include <stdint.h>
+
+/******************************************************************************
+ * Checksum functions
+ *****************************************************************************/
+uint32_t crc32c_update(uint32_t crc, const uint8_t* data, int size);
@@ -0,0 +1,821 @@
+#include <unistd.h>     /* UNIX standard function definitions */
+#include <stdlib.h>     /* Memory allocation and exiting */
+#include <stdio.h>      /* File and printing functions */
+#include <string.h>     /* Used for memory copies */
+#include <poll.h>
+#include <sys/socket.h> /* Unix socket functions */
+#include <sys/un.h>     /* sockaddr_un */
+#include <sys/time.h>   /* timeval */
+
+#include "packet.h"
+#include "radio.h"
+#include "arena.h"
+#include "crc32c.h"
+#include "aggregate.h"
+#include "daemon.h"
+#include "log.h"
+
+/******************************************************************************
+ * A transfer job that is being sent by the daemon. Private.
+ *****************************************************************************/
+struct daemon_job
+{
+	int       active;    // If the job slot is in use
+	int       client;    // The client socket to report the result to
+	uint8_t   stream;    // The stream identifier of the transfer
+	uint8_t   priority;  // Jobs with a higher priority are sent first
+	uint64_t  deadline;  // Absolute time to finish by in milliseconds
+	uint64_t  served;    // When the job last had a packet sent
+	struct arena arena;  // Every data packet of the transfer
+	uint16_t  current;   // The next data chunk to send
+};
+
+/******************************************************************************
+ * A transfer that is being received by the daemon. Private.
+ *****************************************************************************/
+struct daemon_stream
+{
+	uint8_t*  data;         // The data buffer being filled (NULL when idle)
+	int       len;          // The number of bytes recieved
+	uint16_t  current;      // The current data chunk to receive
+	uint16_t  total;        // Total data chunks
+	int       done;         // If the last transfer on the stream completed
+	uint8_t   generation;   // Generation of the current or last transfer
+	uint32_t  digest;       // CRC32C digest of the data recieved so far
+	int       ack_pending;  // If the super-frame being handled needs an ACK
+	uint16_t  ack_seqnum;   // The newest data chunk to acknowledge
+	uint16_t  ack_total;    // Total data chunks to put in the ACK
+};
+
+/******************************************************************************
+ * Reads an exact number of bytes from a socket. Private.
+ *
+ * @param     fd      The socket to read from
+ * @param     buf     The buffer to fill
+ * @param     size    The number of bytes to read
+ *
+ * @return    If the read was successful (0 = success, -1 = failure)
+ *****************************************************************************/
+int daemon_read_full(int fd, void* buf, int size)
+{
+	uint8_t* ptr = (uint8_t*) buf;
+
+	while(size > 0)
+	{
+		int n = read(fd, ptr, size);
+		if(n <= 0) return -1;
+		ptr += n;
+		size -= n;
+	}
+
+	return 0;
+}
+
+/******************************************************************************
+ * Writes an exact number of bytes to a socket. Private.
+ *
+ * @param     fd      The socket to write to
+ * @param     buf     The data to write
+ * @param     size    The number of bytes to write
+ *
+ * @return    If the write was successful (0 = success, -1 = failure)
+ *****************************************************************************/
+int daemon_write_full(int fd, const void* buf, int size)
+{
+	const uint8_t* ptr = (const uint8_t*) buf;
+
+	while(size > 0)
+	{
+		int n = write(fd, ptr, size);
+		if(n <= 0) return -1;
+		ptr += n;
+		size -= n;
+	}
+
+	return 0;
+}
+
+/******************************************************************************
+ * Creates the Unix listen socket that clients submit jobs to. Private.
+ *
+ * @param     path    The filesystem path of the socket
+ *
+ * @return    The file descriptor to the listen socket
+ *****************************************************************************/
+int daemon_listen_socket(const char* path)
+{
+	int sockfd;
+	struct sockaddr_un addr;
+
+	// Create socket
+	sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(sockfd < 0)
+	{
+		log_error("Opening daemon socket");
+		exit(1);
+	}
+
+	// Replace any socket left behind by a previous daemon
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	unlink(path);
+
+	if(bind(sockfd, (struct sockaddr*) &addr, sizeof(addr)) < 0)
+	{
+		log_error("Binding daemon socket %s", path);
+		exit(1);
+	}
+
+	listen(sockfd, DAEMON_MAX_JOBS);
+
+	log("Daemon Listening on %s.\n", path);
+	return sockfd;
+}
+
+/******************************************************************************
+ * Loads the contents of a file into a newly allocated buffer. Private.
+ *
+ * @param     path    The file to load
+ * @param     size    Set to the size of the file
+ *
+ * @return    The file contents (NULL on failure)
+ *****************************************************************************/
+uint8_t* daemon_load_file(const char* path, int* size)
+{
+	FILE* file = fopen(path, "rb");
+	if(file == NULL)
+	{
+		log_error("Unable to open %s", path);
+		return NULL;
+	}
+
+	// Determine the file size
+	fseek(file, 0, SEEK_END);
+	long len = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	uint8_t* data = NULL;
+	if(len > 0 && len <= DAEMON_MAX_JOB_SIZE)
+	{
+		data = (uint8_t*) malloc(len);
+		if(data != NULL && fread(data, 1, len, file) != (size_t) len)
+		{
+			free(data);
+			data = NULL;
+		}
+	}
+
+	fclose(file);
+	*size = (int) len;
+	return data;
+}
+
+/******************************************************************************
+ * Reports the result of a job to its client and releases the job. Private.
+ *
+ * @param     job     The job to release
+ * @param     status  The result of the job (0 = success, -1 = failure)
+ *****************************************************************************/
+void daemon_job_finish(struct daemon_job* job, int32_t status)
+{
+	if(job->deadline != 0 && log_time_us() / 1000 > job->deadline)
+	{
+		log("Stream %d Missed Its Deadline.\n", job->stream);
+	}
+
+	log("Job on Stream %d Finished (%s).\n", job->stream, status == 0 ? "Success" : "Failure");
+
+	daemon_write_full(job->client, &status, sizeof(status));
+	close(job->client);
+	arena_free(&job->arena);
+	memset(job, 0, sizeof(*job));
+}
+
+/******************************************************************************
+ * Finds a free job slot. Private.
+ *
+ * @param     jobs    The job table
+ *
+ * @return    The free job slot (NULL when the table is full)
+ *****************************************************************************/
+struct daemon_job* daemon_job_free(struct daemon_job* jobs)
+{
+	for(int i = 0; i < DAEMON_MAX_JOBS; i++)
+	{
+		if(!jobs[i].active) return &jobs[i];
+	}
+	return NULL;
+}
+
+/******************************************************************************
+ * Picks a stream identifier that is not used by any active job. Stream 0 is
+ * left for single transfers. Private.
+ *
+ * @param     jobs    The job table
+ * @param     next    The next stream identifier to try, advanced on return
+ *
+ * @return    The stream identifier
+ *****************************************************************************/
+uint8_t daemon_job_stream(struct daemon_job* jobs, uint8_t* next)
+{
+	while(1)
+	{
+		uint8_t stream = (*next)++;
+		if(stream == 0) continue;
+
+		int used = 0;
+		for(int i = 0; i < DAEMON_MAX_JOBS; i++)
+		{
+			if(jobs[i].active && jobs[i].stream == stream) used = 1;
+		}
+		if(!used) return stream;
+	}
+}
+
+/******************************************************************************
+ * Accepts a client connection and reads its job request into the job table.
+ * Invalid requests are answered with a failure immediately. Private.
+ *
+ * @param     listen_fd    The daemon listen socket
+ * @param     jobs         The job table
+ * @param     next         The next stream identifier to hand out
+ * @param     generations  The last generation handed out on every stream
+ *
+ * @return    If a client was taken off the listen queue
+ *****************************************************************************/
+int daemon_job_accept(int listen_fd, struct daemon_job* jobs, uint8_t* next, uint8_t* generations)
+{
+	struct daemon_job* job = daemon_job_free(jobs);
+	struct daemon_job_header header;
+	int32_t status = -1;
+
+	// Leave the connection queued until a job slot frees up
+	if(job == NULL) return 0;
+
+	int client = accept(listen_fd, NULL, NULL);
+	if(client < 0)
+	{
+		log_error("Daemon Accept");
+		return 0;
+	}
+
+	// Do not let a stalled client hold up the link
+	struct timeval tv = {1, 0};
+	setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	if(daemon_read_full(client, &header, sizeof(header)) != 0 ||
+	   header.size == 0 || header.size > DAEMON_MAX_JOB_SIZE)
+	{
+		log("Invalid Job Request.\n");
+		daemon_write_full(client, &status, sizeof(status));
+		close(client);
+		return 1;
+	}
+
+	// Read the job payload
+	uint8_t* payload = (uint8_t*) malloc(header.size + 1);
+	if(payload == NULL || daemon_read_full(client, payload, header.size) != 0)
+	{
+		log("Incomplete Job Request.\n");
+		free(payload);
+		daemon_write_full(client, &status, sizeof(status));
+		close(client);
+		return 1;
+	}
+
+	int size = header.size;
+	if(header.type == DAEMON_JOB_FILE)
+	{
+		// The payload is the path of the file to send
+		payload[header.size] = '\0';
+		uint8_t* data = daemon_load_file((const char*) payload, &size);
+		free(payload);
+		payload = data;
+	}
+	else if(header.type != DAEMON_JOB_BUFFER)
+	{
+		free(payload);
+		payload = NULL;
+	}
+
+	if(payload == NULL)
+	{
+		log("Unable to Load Job.\n");
+		daemon_write_full(client, &status, sizeof(status));
+		close(client);
+		return 1;
+	}
+
+	// Build every packet of the job up front. A new generation lets the
+	// receiver tell the job apart from the last transfer on the same stream
+	uint8_t stream = daemon_job_stream(jobs, next);
+	int built = arena_build(&job->arena, payload, size, stream, ++generations[stream]);
+	free(payload);
+
+	if(built != 0)
+	{
+		daemon_write_full(client, &status, sizeof(status));
+		close(client);
+		return 1;
+	}
+
+	// Fill the job slot
+	job->active = 1;
+	job->client = client;
+	job->stream = stream;
+	job->priority = header.priority;
+	job->deadline = header.deadline ? log_time_us() / 1000 + header.deadline : 0;
+	job->served = 0;
+	job->current = 0;
+
+	log("Job Queued on Stream %d (%d Bytes, Priority %d).\n", job->stream, size, job->priority);
+	return 1;
+}
+
+/******************************************************************************
+ * Picks the job to send the next packet of. Higher priority jobs always go
+ * first, jobs of equal priority are sent earliest deadline first and jobs
+ * that are still tied take turns. Private.
+ *
+ * @param     jobs    The job table
+ * @param     picked  Jobs already in the current super-frame (May be NULL)
+ *
+ * @return    The job to send next (NULL when there are no jobs)
+ *****************************************************************************/
+struct daemon_job* daemon_job_next(struct daemon_job* jobs, const uint8_t* picked)
+{
+	struct daemon_job* best = NULL;
+
+	for(int i = 0; i < DAEMON_MAX_JOBS; i++)
+	{
+		struct daemon_job* job = &jobs[i];
+		if(!job->active || (picked != NULL && picked[i])) continue;
+
+		if(best == NULL)
+		{
+			best = job;
+			continue;
+		}
+
+		// Jobs without a deadline are treated as due last
+		uint64_t job_due  = job->deadline  ? job->deadline  : UINT64_MAX;
+		uint64_t best_due = best->deadline ? best->deadline : UINT64_MAX;
+
+		if(job->priority != best->priority)
+		{
+			if(job->priority > best->priority) best = job;
+		}
+		else if(job_due != best_due)
+		{
+			if(job_due < best_due) best = job;
+		}
+		else if(job->served < best->served)
+		{
+			best = job;
+		}
+	}
+
+	return best;
+}
+
+/******************************************************************************
+ * Fills the super-frame with as many consecutive data chunks of the most
+ * urgent job as fit, then lets less urgent jobs use the space left over the
+ * same way. Private.
+ *
+ * @param     ag      The super-frame
+ * @param     jobs    The job table
+ * @param     picked  Set to the number of data chunks added for every job
+ * @param     served  Counter used to make tied jobs take turns
+ *
+ * @return    The number of data chunks added
+ *****************************************************************************/
+int daemon_job_pack(struct aggregate* ag, struct daemon_job* jobs, uint8_t* picked, uint64_t* served)
+{
+	int count = 0;
+	struct daemon_job* job;
+
+	while((job = daemon_job_next(jobs, picked)) != NULL)
+	{
+		int packet_size;
+		int chunks = 0;
+
+		for(int seqnum = job->current; seqnum < job->arena.count; seqnum++)
+		{
+			uint8_t* packet = arena_frame(&job->arena, seqnum, &packet_size);
+			if(!aggregate_fits(ag, packet_size) || aggregate_queue(ag, packet, packet_size) != 0) break;
+			chunks++;
+		}
+
+		// Less urgent jobs wait for the next super-frame
+		if(chunks == 0) break;
+
+		picked[job - jobs] = chunks;
+		job->served = ++(*served);
+		count += chunks;
+	}
+
+	return count;
+}
+
+/******************************************************************************
+ * Handles the replies to a super-frame. ACKs are cumulative, so a job moves
+ * on past every data chunk up to the one acknowledged and the rest are resent
+ * in the next super-frame. Private.
+ *
+ * @param     jobs    The job table
+ * @param     picked  The number of data chunks of every job in the super-frame
+ * @param     buf     The reply super-frame
+ * @param     len     The size of the reply super-frame
+ *****************************************************************************/
+void daemon_job_replies(struct daemon_job* jobs, const uint8_t* picked, uint8_t* buf, int len)
+{
+	int offset = 0;
+	int size;
+	uint8_t* ptr;
+
+	while((ptr = aggregate_next(buf, len, &offset, &size)) != NULL)
+	{
+		struct packet* packet = (struct packet*) ptr;
+		if(packet_verify_format(packet, size) != 1) continue;
+
+		// Find the job the reply belongs to
+		struct daemon_job* job = NULL;
+		int chunks = 0;
+		for(int i = 0; i < DAEMON_MAX_JOBS; i++)
+		{
+			if(picked[i] && jobs[i].active && jobs[i].stream == packet->stream)
+			{
+				job = &jobs[i];
+				chunks = picked[i];
+			}
+		}
+		if(job == NULL) continue;
+
+		switch(packet->type & ITP_TYPE_MASK)
+		{
+			case ITP_TYPE_DATA_ACK:
+				// Ignore stale ACKs of chunks that were not in this super-frame
+				if(packet->seqnum < job->current || packet->seqnum >= job->current + chunks) break;
+				job->current = packet->seqnum + 1;
+				if(job->current == job->arena.count)
+				{
+					daemon_job_finish(job, 0);
+				}
+				break;
+
+			case ITP_TYPE_DATA_ERR:
+				log("Error Recieved on Stream %d.\n", job->stream);
+				daemon_job_finish(job, -1);
+				break;
+
+			default:
+				// NACKs are handled by resending in the next super-frame
+				break;
+		}
+	}
+}
+
+/******************************************************************************
+ * Runs the sending side of the transfer daemon. Jobs are accepted from the
+ * daemon socket and each super-frame is filled with the next data chunks of
+ * the most urgent job, with less urgent jobs only using the space left over,
+ * so the link carries one write and one reply per round instead of one per
+ * packet. Every waiting client is accepted before a super-frame is packed.
+ * After an idle link the first super-frame is held for at most
+ * AGGREGATE_MAX_DELAY in case more jobs arrive, later jobs join at the next
+ * round.
+ *
+ * @param     fd      The file descriptor to the radio device
+ * @param     path    The filesystem path of the daemon socket
+ *
+ * @return    Only returns on failure (-1)
+ *****************************************************************************/
+int daemon_send_main(int fd, const char* path)
+{
+	struct daemon_job jobs[DAEMON_MAX_JOBS];
+	struct aggregate ag;
+	uint32_t reply[AGGREGATE_MAX_SIZE / 4]; // Keeps the packets in the reply aligned
+	uint8_t next_stream = 1;
+	uint8_t generations[256] = {0};
+	uint64_t served = 0;
+
+	memset(jobs, 0, sizeof(jobs));
+	aggregate_init(&ag, fd, AGGREGATE_MAX_SIZE);
+
+	int listen_fd = daemon_listen_socket(path);
+
+	log("Transfer Daemon Started.\n");
+	while(1)
+	{
+		int idle = daemon_job_next(jobs, NULL) == NULL;
+		uint64_t hold = 0;
+		int n;
+
+		// Take every waiting client before packing so the most urgent job goes first
+		do
+		{
+			int timeout = 0;
+
+			// Only block waiting for clients when there is nothing to send
+			if(daemon_job_next(jobs, NULL) == NULL)
+			{
+				timeout = -1;
+			}
+			else if(idle)
+			{
+				// Jobs submitted together after an idle link share the first super-frame
+				uint64_t now = log_time_us() / 1000;
+				if(hold == 0) hold = now + AGGREGATE_MAX_DELAY;
+				timeout = hold > now ? (int) (hold - now) : 0;
+			}
+
+			// Waiting clients stay queued while every job slot is in use
+			struct pollfd pfd = {daemon_job_free(jobs) ? listen_fd : -1, POLLIN, 0};
+
+			n = poll(&pfd, 1, timeout);
+			if(n == -1)
+			{
+				log_error("Daemon poll failed");
+				return -1;
+			}
+			else if(n > 0)
+			{
+				n = daemon_job_accept(listen_fd, jobs, &next_stream, generations);
+			}
+		}
+		while(n > 0);
+
+		uint8_t picked[DAEMON_MAX_JOBS] = {0};
+		int count = daemon_job_pack(&ag, jobs, picked, &served);
+		if(count == 0) continue;
+
+		if(aggregate_flush(&ag) != 0)
+		{
+			log("Unable to Write Super-Frame.\n");
+			continue;
+		}
+
+		// Unacknowledged chunks are resent in the next super-frame
+		n = aggregate_read(fd, (uint8_t*) reply, DAEMON_TIMEOUT_MS);
+		if(n == -1)
+		{
+			log("Radio Link Closed.\n");
+			return -1;
+		}
+		if(n == 0)
+		{
+			log("Super-Frame Timeout. Resending...\n");
+			continue;
+		}
+
+		daemon_job_replies(jobs, picked, (uint8_t*) reply, n);
+	}
+}
+
+/******************************************************************************
+ * Writes a completed transfer to the output directory. Private.
+ *
+ * @param     dir     The output directory
+ * @param     stream  The stream the transfer was recieved on
+ * @param     data    The transfer data
+ * @param     size    The size of the transfer data
+ *****************************************************************************/
+void daemon_stream_save(const char* dir, uint8_t stream, uint8_t* data, int size)
+{
+	static int count = 0; // Number of transfers saved
+	char path[256];
+
+	snprintf(path, sizeof(path), "%s/itp_%03d_%d.bin", dir, stream, count++);
+
+	FILE* file = fopen(path, "wb");
+	if(file == NULL)
+	{
+		log_error("Unable to open %s", path);
+		return;
+	}
+
+	fwrite(data, 1, size, file);
+	fclose(file);
+
+	log("Stream %d Complete (%d Bytes) - %s.\n", stream, size, path);
+}
+
+/******************************************************************************
+ * Handles one data packet of an interleaved transfer. NACKs and errors are
+ * queued right away, while the ACK is only noted so that one ACK per stream
+ * covers every data chunk of the super-frame. Private.
+ *
+ * @param     ag       The reply super-frame
+ * @param     dir      The directory to write completed transfers to
+ * @param     streams  The transfer state of every stream
+ * @param     packet   The packet
+ * @param     n        The size of the packet
+ *****************************************************************************/
+void daemon_stream_packet(struct aggregate* ag, const char* dir, struct daemon_stream* streams, struct packet* packet, int n)
+{
+	uint8_t write_buf[MAX_BUFFER_SIZE] = {0};
+	int packet_size;
+
+	// Senders retransmit on their own, so bad packets are only dropped
+	if(packet_verify_format(packet, n) != 1)
+	{
+		log("Invalid Packet Recieved (%d Bytes).\n", n);
+		return;
+	}
+	if((packet->type & ITP_TYPE_MASK) != ITP_TYPE_DATA_SEND) return;
+
+	struct daemon_stream* st = &streams[packet->stream];
+
+	// Stream ids are reused, so the generation tells the transfers apart
+	int same = (st->data != NULL || st->done) && packet->generation == st->generation;
+
+	// Acknowledge retransmissions of a transfer that already completed
+	if(same && st->data == NULL)
+	{
+		if(packet->seqnum + 1 != st->total) return;
+
+		st->ack_pending = 1;
+		st->ack_seqnum = packet->seqnum;
+		st->ack_total = st->total;
+		return;
+	}
+
+	// Start a new transfer on the stream, dropping one the sender gave up on
+	if(!same && packet->seqnum == 0)
+	{
+		free(st->data);
+		st->data = (uint8_t*) malloc((packet->total + 1) * MAX_DATA_SIZE);
+		st->generation = packet->generation;
+		st->len = 0;
+		st->current = 0;
+		st->total = packet->total;
+		st->done = 0;
+		st->digest = 0;
+	}
+
+	// Ask for the packet we are missing
+	if(st->data == NULL || packet->generation != st->generation || packet->seqnum > st->current)
+	{
+		log("Incorrect Sequence Number on Stream %d. Writing NACK.\n", packet->stream);
+		packet_size = packet_data_nack_create(write_buf, st->current, packet->total);
+		packet_set_stream(write_buf, packet->stream);
+		aggregate_queue(ag, write_buf, packet_size);
+		return;
+	}
+
+	// Only add data to buffer if it is newer
+	if(packet->seqnum == st->current)
+	{
+		int size = packet_data_size(packet);
+		if(st->len + size <= (st->total + 1) * MAX_DATA_SIZE)
+		{
+			memcpy(st->data + st->len, &packet->data, size);
+			st->digest = crc32c_update(st->digest, st->data + st->len, size);
+			st->len += size;
+		}
+		st->current++;
+
+		// The final packet carries the digest of the whole transfer
+		if(!packet_digest_ok(packet, st->digest))
+		{
+			log("Transfer Digest Mismatch on Stream %d. Writing Error...\n", packet->stream);
+			packet_size = packet_data_err_create(write_buf);
+			packet_set_stream(write_buf, packet->stream);
+			aggregate_queue(ag, write_buf, packet_size);
+
+			free(st->data);
+			st->data = NULL;
+			st->ack_pending = 0;
+			return;
+		}
+
+		if(st->current == st->total)
+		{
+			daemon_stream_save(dir, packet->stream, st->data, st->len);
+			free(st->data);
+			st->data = NULL;
+			st->done = 1;
+		}
+	}
+
+	// Acknowledge the newest data chunk recieved in order (Also sent for redundant packets)
+	st->ack_pending = 1;
+	st->ack_seqnum = st->current - 1;
+	st->ack_total = st->total;
+}
+
+/******************************************************************************
+ * Runs the receiving side of the transfer daemon. Every super-frame is split
+ * in place and the transfers interleaved in it are reassembled per stream.
+ * The replies to all of its packets go back as one super-frame, with a single
+ * cumulative ACK per stream. Every completed transfer is checked against its
+ * digest and written to its own file in the output directory.
+ *
+ * @param     fd      The file descriptor to the radio device
+ * @param     dir     The directory to write completed transfers to
+ *
+ * @return    Only returns on failure (-1)
+ *****************************************************************************/
+int daemon_receive_main(int fd, const char* dir)
+{
+	struct aggregate ag;
+	uint32_t frame[AGGREGATE_MAX_SIZE / 4]; // Keeps the packets in the frame aligned
+	uint8_t* buf = (uint8_t*) frame;
+	uint8_t write_buf[MAX_BUFFER_SIZE] = {0};
+
+	struct daemon_stream streams[256];
+	memset(streams, 0, sizeof(streams));
+
+	aggregate_init(&ag, fd, AGGREGATE_MAX_SIZE);
+
+	log("Transfer Daemon Started.\n");
+	while(1)
+	{
+		int n = aggregate_read(fd, buf, -1);
+		if(n == -1)
+		{
+			log("Radio Link Closed.\n");
+			return -1;
+		}
+
+		int offset = 0;
+		int size;
+		uint8_t* packet;
+
+		while((packet = aggregate_next(buf, n, &offset, &size)) != NULL)
+		{
+			daemon_stream_packet(&ag, dir, streams, (struct packet*) packet, size);
+		}
+
+		// One ACK per stream covers every data chunk it had in the super-frame
+		for(int stream = 0; stream < 256; stream++)
+		{
+			struct daemon_stream* st = &streams[stream];
+			if(!st->ack_pending) continue;
+
+			int packet_size = packet_data_ack_create(write_buf, st->ack_seqnum, st->ack_total);
+			packet_set_stream(write_buf, stream);
+			aggregate_queue(&ag, write_buf, packet_size);
+			st->ack_pending = 0;
+		}
+
+		aggregate_flush(&ag);
+	}
+}
+
+/******************************************************************************
+ * Submits a job to a running transfer daemon and waits for it to finish.
+ *
+ * @param     path      The filesystem path of the daemon socket
+ * @param     type      The type of job (Buffer, File)
+ * @param     data      The data to send, or the path of the file to send
+ * @param     size      The size of the data or path
+ * @param     priority  Jobs with a higher priority are sent first
+ * @param     deadline  Milliseconds to finish the job by (0 = none)
+ *
+ * @return    If the job was successful (0 = success, -1 = failure)
+ *****************************************************************************/
+int daemon_submit(const char* path, uint8_t type, uint8_t* data, uint32_t size, uint8_t priority, uint32_t deadline)
+{
+	struct sockaddr_un addr;
+	struct daemon_job_header header;
+	int32_t status = -1;
+
+	int sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(sockfd < 0)
+	{
+		log_error("Opening daemon socket");
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+	if(connect(sockfd, (struct sockaddr*) &addr, sizeof(addr)) < 0)
+	{
+		log_error("Connecting to daemon %s", path);
+		close(sockfd);
+		return -1;
+	}
+
+	// Send the job request
+	memset(&header, 0, sizeof(header));
+	header.type = type;
+	header.priority = priority;
+	header.deadline = deadline;
+	header.size = size;
+
+	if(daemon_write_full(sockfd, &header, sizeof(header)) != 0 ||
+	   daemon_write_full(sockfd, data, size) != 0 ||
+	   daemon_read_full(sockfd, &status, sizeof(status)) != 0)
+	{
+		log("Daemon Connection Lost.\n");
+		status = -1;
+	}
+
+	close(sockfd);
+	return status;
+}
@@ -0,0 +1,41 @@
+/******************************************************************************
+ * File: daemon.h
+ *
+ * Description: Describes the transfer daemon which keeps the radio link open
+ *              and schedules transfer jobs submitted over a local socket
+ *****************************************************************************/
+#pragma once
+#include <stdint.h>
+
+#include "radio.h"
+
+#define DAEMON_SOCKET_PATH "/tmp/itp_daemon.sock"
+#define DAEMON_MAX_JOBS     16
+#define DAEMON_MAX_JOB_SIZE (0xFFFF * MAX_DATA_SIZE)
+#define DAEMON_TIMEOUT_MS   250 // Time to wait for the replies to a super-frame (A full one takes ~45 ms at 57600 baud)
+
+/******************************************************************************
+ * Job types
+ *****************************************************************************/
+#define DAEMON_JOB_BUFFER 0x01 // The job data follows the header
+#define DAEMON_JOB_FILE   0x02 // The path of a file to send follows the header
+
+/******************************************************************************
+ * Job request sent by clients over the daemon socket. The header is followed
+ * by size bytes of data or file path. Once the job has finished, the daemon
+ * replies with a single int32_t status (0 = success, -1 = failure).
+ *****************************************************************************/
+struct daemon_job_header
+{
+	uint8_t   type;      // The type of job (Buffer, File)
+	uint8_t   priority;  // Jobs with a higher priority are sent first
+	uint32_t  deadline;  // Milliseconds after submission to finish by (0 = none)
+	uint32_t  size;      // Size of the data or path following the header
+};
+
+/******************************************************************************
+ * Daemon functions
+ *****************************************************************************/
+int daemon_send_main(int fd, const char* path);
+int daemon_receive_main(int fd, const char* dir);
+int daemon_submit(const char* path, uint8_t type, uint8_t* data, uint32_t size, uint8_t priority, uint32_t deadline);
@@ -2,7 +2,7 @@
 #include <stdio.h>    /* printf */
 #include <stdarg.h>   /* va_arg */
 #include <stdint.h>   /* uint */
-#include <time.h>     /* strftime, localtime */
+#include <time.h>     /* strftime, localtime, clock_gettime */
 #include <errno.h>    /* errno */
 #include <string.h>   /* strerror */
 
@@ -34,6 +34,14 @@ char* log_gettime()
 	return buf;
 }
 
+// Monotonic timestamp in microseconds, for timeouts and rate measurements
+uint64_t log_time_us()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 void log(const char* fmt, ...)
 {
 #ifndef LOG_DISABLE
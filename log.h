@@ -5,6 +5,8 @@
  **********************************************************************/
 
 #pragma once
+#include <stdint.h>
 
 void log(const char* fmt, ...);
 void log_error(const char* fmt, ...);
+uint64_t log_time_us();
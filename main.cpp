@@ -1,10 +1,16 @@
 #include <termios.h> /* POSIX terminal control definitions */
 #include <stdio.h>   /* Printing functions */
+#include <stdlib.h>  /* atoi */
+#include <string.h>  /* strcmp, strlen */
 
 #include "packet.h"
 #include "radio.h"
 #include "log.h"
 #include "sim.h"
+#include "daemon.h"
+#include "bond.h"
+#include "session.h"
+#include "progressive.h"
 
 int beagleboard_main()
 {
@@ -50,8 +56,281 @@ int base_main()
 	return 0;
 }
 
-int main()
+int beagleboard_daemon_main()
 {
+	log("Beagleboard Daemon Started.\n");
+
+	int fd = 0;
+
+	// Get the transmission device file descriptor once for all transfers
+	fd = sim_tcp_server_socket();
+	// fd = radio_open("/dev/ttyUSB0");
+	// radio_config(fd, B57600); // 8N1 @ 57600
+
+	// Send jobs submitted by local clients
+	return daemon_send_main(fd, DAEMON_SOCKET_PATH);
+}
+
+int base_daemon_main()
+{
+	log("Base Station Daemon Started.\n");
+	int fd = 0;
+
+	// Get the transmission device file descriptor once for all transfers
+	fd = sim_tcp_client_socket("10.0.0.1");
+	// fd = radio_open("/dev/ttyUSB0");
+	// radio_config(fd, B115200); // 8N1 @ 115200
+
+	// Save every transfer to the working directory
+	return daemon_receive_main(fd, ".");
+}
+
+int beagleboard_bond_main(int count)
+{
+	log("Beagleboard Bonded Link Started.\n");
+
+	struct bond bond;
+	int fds[BOND_MAX_LINKS];
+
+	// Get one transmission device file descriptor per radio
+	bond_init(&bond);
+	sim_tcp_server_sockets(fds, count);
+	for(int i = 0; i < count; i++)
+	{
+		bond_add(&bond, fds[i]);
+	}
+	// const char* devices[] = {"/dev/ttyUSB0", "/dev/ttyUSB1"};
+	// bond_open(&bond, devices, 2, B57600); // 8N1 @ 57600
+
+	// Allocate write data buffer
+	uint8_t data[256] = {0};
+
+	// Fill buffer
+	for(int i=0; i<256; i++)
+	{
+		data[i] = i*21;
+	}
+
+	// Transmit data
+	return bond_data_send(&bond, data, 256) == 0 ? 0 : 1;
+}
+
+int base_bond_main(int count)
+{
+	log("Base Station Bonded Link Started.\n");
+
+	struct bond bond;
+
+	// Get one transmission device file descriptor per radio
+	bond_init(&bond);
+	for(int i = 0; i < count; i++)
+	{
+		bond_add(&bond, sim_tcp_client_socket("10.0.0.1"));
+	}
+	// const char* devices[] = {"/dev/ttyUSB0", "/dev/ttyUSB1"};
+	// bond_open(&bond, devices, 2, B115200); // 8N1 @ 115200
+
+	// Allocate read data buffer
+	uint8_t data[MAX_BUFFER_SIZE] = {0};
+
+	// Retrieve data
+	return bond_data_receive(&bond, data, MAX_BUFFER_SIZE) < 0 ? 1 : 0;
+}
+
+void session_command(uint8_t* data, int size, void* arg)
+{
+	log("Command Recieved: %.*s\n", size, (char*) data);
+}
+
+int beagleboard_session_main()
+{
+	log("Beagleboard Session Started.\n");
+
+	int fd = 0;
+	struct session session;
+
+	// Get the transmission device file descriptor
+	fd = sim_tcp_server_socket();
+	// fd = radio_open("/dev/ttyUSB0");
+	// radio_config(fd, B57600); // 8N1 @ 57600
+
+	// Allocate write data buffer and command buffer
+	uint8_t data[256] = {0};
+	uint8_t commands[MAX_BUFFER_SIZE] = {0};
+
+	// Fill buffer
+	for(int i=0; i<256; i++)
+	{
+		data[i] = i*21;
+	}
+
+	// Transmit data downlink while receiving commands uplink
+	session_init(&session, fd, commands, sizeof(commands), session_command, NULL);
+	session_send(&session, data, 256);
+	int status = session_run(&session);
+	session_close(&session);
+
+	return status == 0 ? 0 : 1;
+}
+
+int base_session_main()
+{
+	log("Base Station Session Started.\n");
+
+	int fd = 0;
+	struct session session;
+
+	// Get the transmission device file descriptor
+	fd = sim_tcp_client_socket("10.0.0.1");
+	// fd = radio_open("/dev/ttyUSB0");
+	// radio_config(fd, B115200); // 8N1 @ 115200
+
+	// Allocate read data buffer
+	uint8_t data[MAX_BUFFER_SIZE] = {0};
+	char config[] = "CONFIG EXPOSURE=10 GAIN=2";
+	char capture[] = "CAPTURE";
+
+	// Transmit commands uplink while receiving data downlink
+	session_init(&session, fd, data, sizeof(data), NULL, NULL);
+	session_send(&session, (uint8_t*) config, sizeof(config));
+	session_send(&session, (uint8_t*) capture, sizeof(capture));
+	int status = session_run(&session);
+	session_close(&session);
+
+	return status == 0 ? 0 : 1;
+}
+
+int beagleboard_progressive_main()
+{
+	log("Beagleboard Progressive Transfer Started.\n");
+
+	int fd = 0;
+	struct progressive_image image = {64, 48, 1, 16, 32}; // 64x48 grayscale, rows 16-31 first
+
+	// Get the transmission device file descriptor
+	fd = sim_tcp_server_socket();
+	// fd = radio_open("/dev/ttyUSB0");
+	// radio_config(fd, B57600); // 8N1 @ 57600
+
+	// Allocate and fill a test image
+	uint8_t* data = (uint8_t*) malloc(image.width * image.height);
+	for(int i = 0; i < image.width * image.height; i++)
+	{
+		data[i] = i*21;
+	}
+
+	// Transmit image
+	int status = progressive_send(fd, &image, data);
+	free(data);
+	return status == 0 ? 0 : 1;
+}
+
+int base_preview(int pass, uint8_t* preview, void* arg)
+{
+	// Operators would display the preview here and may cancel the transfer
+	log("Preview Updated After Pass %d.\n", pass);
+	return 0;
+}
+
+int base_progressive_main()
+{
+	log("Base Station Progressive Transfer Started.\n");
+
+	int fd = 0;
+	struct progressive_image image = {64, 48, 1, 16, 32}; // Must match the beagleboard
+
+	// Get the transmission device file descriptor
+	fd = sim_tcp_client_socket("10.0.0.1");
+	// fd = radio_open("/dev/ttyUSB0");
+	// radio_config(fd, B115200); // 8N1 @ 115200
+
+	// Allocate image and preview buffers
+	uint8_t* data = (uint8_t*) calloc(image.width * image.height, 1);
+	uint8_t* preview = (uint8_t*) calloc(image.width * image.height, 1);
+
+	// Retrieve image
+	int n = progressive_receive(fd, &image, data, preview, base_preview, NULL);
+	free(data);
+	free(preview);
+	return n < 0 ? 1 : 0;
+}
+
+int bench_pty_main(int bytes)
+{
+	log("Serial Benchmark Started.\n");
+
+	// Compare the default and raw serial configurations on the same harness
+	sim_pty_benchmark(0, bytes);
+	sim_pty_benchmark(1, bytes);
+	return 0;
+}
+
+int submit_main(const char* file, int priority, int deadline)
+{
+	// Queue the file on the running daemon and wait for it to be sent
+	int status = daemon_submit(DAEMON_SOCKET_PATH, DAEMON_JOB_FILE, (uint8_t*) file, strlen(file), priority, deadline);
+	log("Transfer of %s %s.\n", file, status == 0 ? "Complete" : "Failed");
+	return status == 0 ? 0 : 1;
+}
+
+int main(int argc, char** argv)
+{
+	// Run code for specified mode
+	if(argc > 1 && strcmp(argv[1], "base") == 0)
+	{
+		return base_main();
+	}
+	if(argc > 1 && strcmp(argv[1], "daemon") == 0)
+	{
+		return beagleboard_daemon_main();
+	}
+	if(argc > 1 && strcmp(argv[1], "base-daemon") == 0)
+	{
+		return base_daemon_main();
+	}
+	if(argc > 2 && strcmp(argv[1], "bond") == 0)
+	{
+		// bond <number of radios>
+		int count = atoi(argv[2]);
+		if(count < 1 || count > BOND_MAX_LINKS) count = 1;
+		return beagleboard_bond_main(count);
+	}
+	if(argc > 2 && strcmp(argv[1], "base-bond") == 0)
+	{
+		int count = atoi(argv[2]);
+		if(count < 1 || count > BOND_MAX_LINKS) count = 1;
+		return base_bond_main(count);
+	}
+	if(argc > 1 && strcmp(argv[1], "session") == 0)
+	{
+		return beagleboard_session_main();
+	}
+	if(argc > 1 && strcmp(argv[1], "base-session") == 0)
+	{
+		return base_session_main();
+	}
+	if(argc > 1 && strcmp(argv[1], "progressive") == 0)
+	{
+		return beagleboard_progressive_main();
+	}
+	if(argc > 1 && strcmp(argv[1], "base-progressive") == 0)
+	{
+		return base_progressive_main();
+	}
+	if(argc > 1 && strcmp(argv[1], "bench-pty") == 0)
+	{
+		// bench-pty [bytes]
+		int bytes = argc > 2 ? atoi(argv[2]) : 65536;
+		return bench_pty_main(bytes);
+	}
+	if(argc > 2 && strcmp(argv[1], "submit") == 0)
+	{
+		// submit <file> [priority] [deadline ms]
+		int priority = argc > 3 ? atoi(argv[3]) : 0;
+		int deadline = argc > 4 ? atoi(argv[4]) : 0;
+		return submit_main(argv[2], priority, deadline);
+	}
+
 	// Run code for specified device
 	return beagleboard_main();
 }
\ No newline at end of file
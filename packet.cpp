@@ -19,9 +19,13 @@ int packet_data_send_create(uint8_t* buf, uint8_t* data, uint16_t size, uint16_t
 	struct packet* packet = (struct packet*) buf;
 
 	packet->type = ITP_TYPE_DATA_SEND;
+	packet->stream = 0;
 	packet->seqnum = seqnum;
 	packet->total = total;
 	packet->size = size;
+	packet->ack = 0;
+	packet->ack_stream = 0;
+	packet->generation = 0;
 
 	memcpy(&packet->data, data, size);
 
@@ -45,9 +49,13 @@ int packet_data_ack_create(uint8_t* buf, uint16_t seqnum, uint16_t total)
 	struct packet* packet = (struct packet*) buf;
 
 	packet->type = ITP_TYPE_DATA_ACK;
+	packet->stream = 0;
 	packet->seqnum = seqnum;
 	packet->total = total;
 	packet->size = 0;
+	packet->ack = 0;
+	packet->ack_stream = 0;
+	packet->generation = 0;
 	packet->data = 0;
 	packet->crc = packet_generate_crc(packet);
 	
@@ -69,9 +77,13 @@ int packet_data_nack_create(uint8_t* buf, uint16_t seqnum, uint16_t total)
 	struct packet* packet = (struct packet*) buf;
 
 	packet->type = ITP_TYPE_DATA_NACK;
+	packet->stream = 0;
 	packet->seqnum = seqnum;
 	packet->total = total;
 	packet->size = 0;
+	packet->ack = 0;
+	packet->ack_stream = 0;
+	packet->generation = 0;
 	packet->data = 0;
 	packet->crc = packet_generate_crc(packet);
 
@@ -91,15 +103,79 @@ int packet_data_err_create(uint8_t* buf)
 	struct packet* packet = (struct packet*) buf;
 
 	packet->type = ITP_TYPE_DATA_ERR;
+	packet->stream = 0;
 	packet->seqnum = 0;
 	packet->total = 0;
 	packet->size = 0;
+	packet->ack = 0;
+	packet->ack_stream = 0;
+	packet->generation = 0;
 	packet->data = 0;
 	packet->crc = packet_generate_crc(packet);
 
 	return sizeof(struct packet);
 }
 
+/******************************************************************************
+ * Creates an end of session message for when there is no more data to send.
+ * The buffer must made be large enough to hold the entire packet contents.
+ *
+ * @param     buf     The buffer to insert the packet into
+ *
+ * @return    The size of the packet generated
+ *****************************************************************************/
+int packet_data_fin_create(uint8_t* buf)
+{
+	struct packet* packet = (struct packet*) buf;
+
+	packet->type = ITP_TYPE_DATA_FIN;
+	packet->stream = 0;
+	packet->seqnum = 0;
+	packet->total = 0;
+	packet->size = 0;
+	packet->ack = 0;
+	packet->ack_stream = 0;
+	packet->generation = 0;
+	packet->data = 0;
+	packet->crc = packet_generate_crc(packet);
+
+	return sizeof(struct packet);
+}
+
+/******************************************************************************
+ * Adds an acknowledgement of reverse direction data to an already created
+ * packet, so that a data packet can carry the ACK instead of sending it on
+ * its own. The checksum is regenerated so the packet remains valid.
+ *
+ * @param     buf     The buffer holding the packet
+ * @param     stream  The stream of the data packet that was recieved
+ * @param     seqnum  The sequence number of the data packet that was recieved
+ *****************************************************************************/
+void packet_set_ack(uint8_t* buf, uint8_t stream, uint16_t seqnum)
+{
+	struct packet* packet = (struct packet*) buf;
+
+	packet->type |= ITP_FLAG_ACK;
+	packet->ack = seqnum;
+	packet->ack_stream = stream;
+	packet->crc = packet_generate_crc(packet);
+}
+
+/******************************************************************************
+ * Tags an already created packet with the transfer stream it belongs to. The
+ * checksum is regenerated so the packet remains valid.
+ *
+ * @param     buf     The buffer holding the packet
+ * @param     stream  The stream identifier of the transfer
+ *****************************************************************************/
+void packet_set_stream(uint8_t* buf, uint8_t stream)
+{
+	struct packet* packet = (struct packet*) buf;
+
+	packet->stream = stream;
+	packet->crc = packet_generate_crc(packet);
+}
+
 /******************************************************************************
  * Creates a CRC checksum on a data buffer of a specified size. This is a
  * private function that should not be called directly.
@@ -126,6 +202,114 @@ uint16_t generate_crc(uint8_t *ptr, int psize)
 	return crc;
 }
 
+/******************************************************************************
+ * Gets the lookup table for the packet checksum, one entry per byte value.
+ * The table is built on first use. Private.
+ *
+ * @return    The checksum lookup table
+ *****************************************************************************/
+const uint16_t* generate_crc_table()
+{
+	static uint16_t table[256];
+	static int ready = 0;
+
+	if(!ready)
+	{
+		for(int b = 0; b < 256; b++)
+		{
+			uint8_t byte = b;
+			table[b] = generate_crc(&byte, 1);
+		}
+		ready = 1;
+	}
+
+	return table;
+}
+
+/******************************************************************************
+ * Gets the number of bytes a packet checksum is generated over, starting at
+ * the packet type. Private.
+ *
+ * @param     packet  The packet to find the checksum size of
+ *
+ * @return    The number of checksummed bytes
+ *****************************************************************************/
+int packet_crc_size(struct packet* packet)
+{
+	int size = sizeof(struct packet) - 2;
+	if(packet->size > 0)
+	{
+		size = size - 1 + packet->size;
+	}
+	return size;
+}
+
+/******************************************************************************
+ * Generates the CRC checksums of many packets at once and stores them in the
+ * packets. Four packets are processed side by side so the table lookups of
+ * one packet overlap with the others instead of waiting on each other. The
+ * result is identical to packet_generate_crc. The lookup table must be built
+ * (by any previous call) before this is called from several threads.
+ *
+ * @param     packets  The packets to generate the checksums of
+ * @param     count    The number of packets
+ *****************************************************************************/
+void packet_generate_crc_batch(struct packet** packets, int count)
+{
+	const uint16_t* table = generate_crc_table();
+	int i = 0;
+
+	for(; i + 4 <= count; i += 4)
+	{
+		uint8_t* p0 = &packets[i+0]->type;
+		uint8_t* p1 = &packets[i+1]->type;
+		uint8_t* p2 = &packets[i+2]->type;
+		uint8_t* p3 = &packets[i+3]->type;
+		int n0 = packet_crc_size(packets[i+0]);
+		int n1 = packet_crc_size(packets[i+1]);
+		int n2 = packet_crc_size(packets[i+2]);
+		int n3 = packet_crc_size(packets[i+3]);
+		uint16_t c0 = 0, c1 = 0, c2 = 0, c3 = 0;
+
+		// Run the four checksums together over the bytes they all have
+		int common = n0;
+		if(n1 < common) common = n1;
+		if(n2 < common) common = n2;
+		if(n3 < common) common = n3;
+
+		for(int j = 0; j < common; j++)
+		{
+			c0 = (c0 << 8) ^ table[(c0 >> 8) ^ p0[j]];
+			c1 = (c1 << 8) ^ table[(c1 >> 8) ^ p1[j]];
+			c2 = (c2 << 8) ^ table[(c2 >> 8) ^ p2[j]];
+			c3 = (c3 << 8) ^ table[(c3 >> 8) ^ p3[j]];
+		}
+
+		// Finish the longer packets one at a time
+		for(int j = common; j < n0; j++) c0 = (c0 << 8) ^ table[(c0 >> 8) ^ p0[j]];
+		for(int j = common; j < n1; j++) c1 = (c1 << 8) ^ table[(c1 >> 8) ^ p1[j]];
+		for(int j = common; j < n2; j++) c2 = (c2 << 8) ^ table[(c2 >> 8) ^ p2[j]];
+		for(int j = common; j < n3; j++) c3 = (c3 << 8) ^ table[(c3 >> 8) ^ p3[j]];
+
+		packets[i+0]->crc = c0;
+		packets[i+1]->crc = c1;
+		packets[i+2]->crc = c2;
+		packets[i+3]->crc = c3;
+	}
+
+	// Remaining packets
+	for(; i < count; i++)
+	{
+		uint8_t* p = &packets[i]->type;
+		int n = packet_crc_size(packets[i]);
+		uint16_t c = 0;
+
+		for(int j = 0; j < n; j++) c = (c << 8) ^ table[(c >> 8) ^ p[j]];
+
+		packets[i]->crc = c;
+	}
+}
+
 /******************************************************************************
  * Gets the CRC checksum of a specified packet. The CRC is generated over the
  * packet header as well as data if it exists. The previously set checksum is
@@ -137,12 +321,7 @@ uint16_t generate_crc(uint8_t *ptr, int psize)
  *****************************************************************************/
 uint16_t packet_generate_crc(struct packet* packet)
 {
-	int size = sizeof(struct packet) - 2;
-	if(packet->size > 0)
-	{
-		size = size - 1 + packet->size;
-	}
-	return generate_crc( (uint8_t*) &packet->type, size); 
+	return generate_crc( (uint8_t*) &packet->type, packet_crc_size(packet)); 
 }
 
 /******************************************************************************
@@ -177,4 +356,50 @@ int packet_verify_format(struct packet* packet, int recieve_size)
 	}
 
 	return 1;
-}
\ No newline at end of file
+}
+
+/******************************************************************************
+ * Gets the size of the transfer data held by a data packet. This excludes the
+ * transfer digest carried by the final packet.
+ *
+ * @param     packet  The data packet
+ *
+ * @return    The size of the transfer data
+ *****************************************************************************/
+int packet_data_size(struct packet* packet)
+{
+	if((packet->type & ITP_FLAG_DIGEST) && packet->size >= ITP_DIGEST_SIZE)
+	{
+		return packet->size - ITP_DIGEST_SIZE;
+	}
+	return packet->size;
+}
+
+/******************************************************************************
+ * Gets the CRC32C digest of the whole transfer from its final data packet.
+ * Only valid when the packet has ITP_FLAG_DIGEST set.
+ *
+ * @param     packet  The final data packet
+ *
+ * @return    The transfer digest
+ *****************************************************************************/
+uint32_t packet_digest(struct packet* packet)
+{
+	uint32_t digest;
+	memcpy(&digest, &packet->data + packet_data_size(packet), ITP_DIGEST_SIZE);
+	return digest;
+}
+
+/******************************************************************************
+ * Checks the transfer digest carried by the final data packet against the
+ * digest of the data recieved. Packets without a digest always pass.
+ *
+ * @param     packet  The data packet
+ * @param     digest  The CRC32C digest of the data recieved
+ *
+ * @return    If the digest matches or the packet has none
+ *****************************************************************************/
+int packet_digest_ok(struct packet* packet, uint32_t digest)
+{
+	return !(packet->type & ITP_FLAG_DIGEST) || packet_digest(packet) == digest;
+}
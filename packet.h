@@ -12,12 +12,16 @@
  *****************************************************************************/
 struct packet
 {
-	uint16_t  crc;     // The packet checksum
-	uint8_t   type;    // The type of packet (Data, ACK, NACK)
-	uint16_t  seqnum;  // The packet sequence number out of total packets
-	uint16_t  total;   // Total packets
-	uint16_t  size;    // Total size of the data
-	uint8_t   data;    // Start of the data
+	uint16_t  crc;         // The packet checksum
+	uint8_t   type;        // The type of packet (Data, ACK, NACK)
+	uint8_t   stream;      // The transfer the packet belongs to (0 = single transfer)
+	uint16_t  seqnum;      // The packet sequence number out of total packets
+	uint16_t  total;       // Total packets
+	uint16_t  size;        // Total size of the data
+	uint16_t  ack;         // Sequence number acknowledged (Only with ITP_FLAG_ACK)
+	uint8_t   ack_stream;  // Stream of the acknowledged data (Only with ITP_FLAG_ACK)
+	uint8_t   generation;  // Changes every time the stream is reused for a new transfer
+	uint8_t   data;        // Start of the data
 };
 
 /******************************************************************************
@@ -27,6 +31,13 @@ struct packet
 #define ITP_TYPE_DATA_ACK  0x02 // Data was recieved successfully
 #define ITP_TYPE_DATA_NACK 0x03 // Data was recieved unsuccessfully
 #define ITP_TYPE_DATA_ERR  0x04 // Data was recieved but there was an error
+#define ITP_TYPE_DATA_FIN  0x05 // Sender has no more data to send
+
+#define ITP_TYPE_MASK      0x0F // Bits holding the packet type
+#define ITP_FLAG_ACK       0x80 // Packet also acknowledges reverse direction data
+#define ITP_FLAG_DIGEST    0x40 // Data ends with the CRC32C digest of the whole transfer
+
+#define ITP_DIGEST_SIZE    4    // Size of the transfer digest
 
 /******************************************************************************
  * Packet creation methods
@@ -35,9 +46,16 @@ int packet_data_send_create(uint8_t* buf, uint8_t* data, uint16_t size, uint16_t
 int packet_data_ack_create(uint8_t* buf, uint16_t seqnum, uint16_t total);
 int packet_data_nack_create(uint8_t* buf, uint16_t seqnum, uint16_t total);
 int packet_data_err_create(uint8_t* buf);
+int packet_data_fin_create(uint8_t* buf);
 
 /******************************************************************************
  * Helper functions
  *****************************************************************************/
+void packet_set_stream(uint8_t* buf, uint8_t stream);
+void packet_set_ack(uint8_t* buf, uint8_t stream, uint16_t seqnum);
 uint16_t packet_generate_crc(struct packet* packet);
-int packet_verify_format(struct packet* packet, int recieve_size);
\ No newline at end of file
+void packet_generate_crc_batch(struct packet** packets, int count);
+int packet_verify_format(struct packet* packet, int recieve_size);
+int packet_data_size(struct packet* packet);
+uint32_t packet_digest(struct packet* packet);
+int packet_digest_ok(struct packet* packet, uint32_t digest);
\ No newline at end of file
@@ -0,0 +1,341 @@
+#include <unistd.h>  /* UNIX standard function definitions */
+#include <stdlib.h>  /* Memory allocation */
+#include <string.h>  /* Used for memory copies */
+
+#include "packet.h"
+#include "radio.h"
+#include "arena.h"
+#include "progressive.h"
+#include "crc32c.h"
+#include "log.h"
+
+/******************************************************************************
+ * Gets the interlaced pass a row of the image is sent in. Every eighth row
+ * is sent first, then the rows halfway between them, then the rows a quarter
+ * of the way and finally all odd rows, so each pass doubles the vertical
+ * resolution of the preview.
+ *
+ * @param     row     The image row
+ *
+ * @return    The pass of the row (0 = first)
+ *****************************************************************************/
+int progressive_row_pass(int row)
+{
+	if(row % 8 == 0) return 0;
+	if(row % 8 == 4) return 1;
+	if(row % 2 == 0) return 2;
+	return 3;
+}
+
+/******************************************************************************
+ * Gets the size of the image in bytes. Private.
+ *
+ * @param     image   The image layout
+ *
+ * @return    The size of the image
+ *****************************************************************************/
+int progressive_size(const struct progressive_image* image)
+{
+	return image->width * image->bpp * image->height;
+}
+
+/******************************************************************************
+ * Works out the order to send the data chunks of an image in. Chunks are sent
+ * pass by pass, and within a pass the chunks holding rows of the region of
+ * interest go first. A chunk that spans several rows is sent in the earliest
+ * pass of those rows.
+ *
+ * @param     image   The image layout
+ * @param     order   Filled with the data chunks in the order to send them
+ * @param     passes  Filled with the pass of every data chunk
+ *
+ * @return    The number of data chunks
+ *****************************************************************************/
+int progressive_order(const struct progressive_image* image, uint16_t* order, uint8_t* passes)
+{
+	int stride = image->width * image->bpp;
+	int size = progressive_size(image);
+	int count = (size + MAX_DATA_SIZE - 1) / MAX_DATA_SIZE;
+	int start[PROGRESSIVE_PASSES * 2] = {0};
+
+	uint8_t* keys = (uint8_t*) malloc(count ? count : 1);
+	if(keys == NULL)
+	{
+		log_error("Allocating chunk order");
+		return -1;
+	}
+
+	// Sort key of every chunk: its pass, then region of interest first
+	for(int k = 0; k < count; k++)
+	{
+		int first = k * MAX_DATA_SIZE;
+		int last = first + MAX_DATA_SIZE < size ? first + MAX_DATA_SIZE - 1 : size - 1;
+		int pass = PROGRESSIVE_PASSES - 1;
+		int roi = 0;
+
+		for(int r = first / stride; r <= last / stride; r++)
+		{
+			if(progressive_row_pass(r) < pass) pass = progressive_row_pass(r);
+			if(r >= image->roi_top && r < image->roi_bottom) roi = 1;
+		}
+
+		passes[k] = pass;
+		keys[k] = pass * 2 + !roi;
+		start[keys[k]]++;
+	}
+
+	// Counting sort keeps chunks of the same key in buffer order
+	for(int key = 0, pos = 0; key < PROGRESSIVE_PASSES * 2; key++)
+	{
+		int n = start[key];
+		start[key] = pos;
+		pos += n;
+	}
+	for(int k = 0; k < count; k++)
+	{
+		order[start[keys[k]]++] = k;
+	}
+
+	free(keys);
+	return count;
+}
+
+/******************************************************************************
+ * Write an image in progressive order. The receiver must use the same image
+ * layout.
+ *
+ * @param     fd      The file descriptor to the radio device
+ * @param     image   The image layout
+ * @param     data    The image data
+ *
+ * @return    If transfer was successful (0 = success, -1 = failure or cancel)
+ *****************************************************************************/
+int progressive_send(int fd, const struct progressive_image* image, uint8_t* data)
+{
+	struct arena arena;
+	int status = 0;
+
+	// Build every packet up front, they are sent out of buffer order
+	if(arena_build(&arena, data, progressive_size(image), 0, 0) != 0)
+	{
+		return -1;
+	}
+
+	uint16_t* order = (uint16_t*) malloc(sizeof(uint16_t) * (arena.count ? arena.count : 1));
+	uint8_t* passes = (uint8_t*) malloc(arena.count ? arena.count : 1);
+	if(order == NULL || passes == NULL || progressive_order(image, order, passes) < 0)
+	{
+		free(order);
+		free(passes);
+		arena_free(&arena);
+		return -1;
+	}
+
+	log("Starting progressive packet writing...\n");
+	for(int i = 0; i < arena.count; i++)
+	{
+		int packet_size;
+		uint8_t* packet = arena_frame(&arena, order[i], &packet_size);
+
+		// Send the packet and wait for an ACK
+		if(radio_packet_send(fd, packet, packet_size) != 0)
+		{
+			log("Progressive Transfer Stopped.\n");
+			status = -1;
+			break;
+		}
+
+		if(i + 1 == arena.count || passes[order[i+1]] != passes[order[i]])
+		{
+			log("Pass %d Sent.\n", passes[order[i]]);
+		}
+	}
+
+	if(status == 0) log("Writing Complete.\n");
+
+	free(order);
+	free(passes);
+	arena_free(&arena);
+	return status;
+}
+
+/******************************************************************************
+ * Updates the preview once a row of the image is complete. The row is copied
+ * into the preview and also stands in for the missing rows below it, up to
+ * the next complete row. Rows above the first complete row are filled from
+ * it as well. Private.
+ *
+ * @param     image     The image layout
+ * @param     data      The image data
+ * @param     preview   The preview image
+ * @param     complete  Which rows are complete
+ * @param     row       The row that was completed
+ *****************************************************************************/
+void progressive_preview_row(const struct progressive_image* image, uint8_t* data, uint8_t* preview, uint8_t* complete, int row)
+{
+	int stride = image->width * image->bpp;
+	uint8_t* src = data + row * stride;
+	int y;
+
+	complete[row] = 1;
+	memcpy(preview + row * stride, src, stride);
+
+	// Fill the rows below that are still missing
+	for(y = row + 1; y < image->height && !complete[y]; y++)
+	{
+		memcpy(preview + y * stride, src, stride);
+	}
+
+	// Fill the top of the image until a complete row exists there
+	for(y = row - 1; y >= 0 && !complete[y]; y--);
+	if(y < 0)
+	{
+		for(y = 0; y < row; y++)
+		{
+			memcpy(preview + y * stride, src, stride);
+		}
+	}
+}
+
+/******************************************************************************
+ * Read an image sent in progressive order. The preview is updated as rows
+ * arrive and the callback is run after each pass, which can cancel the
+ * transfer. The whole image is checked against its digest before the last
+ * ACK.
+ *
+ * @param     fd        The file descriptor to the radio device
+ * @param     image     The image layout
+ * @param     data      The image buffer to fill
+ * @param     preview   The preview buffer to update (Same size as the image)
+ * @param     callback  Called after each pass (May be NULL)
+ * @param     arg       Passed to the callback
+ *
+ * @return    The number of bytes recieved (-1 = failure, cancel or digest mismatch)
+ *****************************************************************************/
+int progressive_receive(int fd, const struct progressive_image* image, uint8_t* data, uint8_t* preview, progressive_callback callback, void* arg)
+{
+	// Allocate packet buffers
+	uint8_t write_buf[MAX_BUFFER_SIZE] = {0};
+	uint8_t read_buf[MAX_BUFFER_SIZE] = {0};
+	uint8_t final_buf[MAX_BUFFER_SIZE] = {0}; // The final packet, which carries the digest
+	struct packet* packet = (struct packet*) read_buf;
+
+	int stride = image->width * image->bpp;
+	int size = progressive_size(image);
+	int count = (size + MAX_DATA_SIZE - 1) / MAX_DATA_SIZE;
+	int remaining[PROGRESSIVE_PASSES] = {0}; // Data chunks missing from each pass
+	int got = 0;                             // Data chunks recieved
+	int status = 0;
+	int packet_size;
+
+	uint16_t* order = (uint16_t*) malloc(sizeof(uint16_t) * (count ? count : 1));
+	uint8_t* passes = (uint8_t*) malloc(count ? count : 1);
+	uint8_t* received = (uint8_t*) calloc(count ? count : 1, 1);
+	uint8_t* complete = (uint8_t*) calloc(image->height ? image->height : 1, 1);
+	int* missing = (int*) calloc(image->height ? image->height : 1, sizeof(int));
+
+	if(order == NULL || passes == NULL || received == NULL || complete == NULL || missing == NULL ||
+	   progressive_order(image, order, passes) < 0)
+	{
+		status = -1;
+		count = 0;
+	}
+
+	// Count the data chunks of every pass and every row
+	for(int k = 0; k < count; k++)
+	{
+		int first = k * MAX_DATA_SIZE;
+		int last = first + MAX_DATA_SIZE < size ? first + MAX_DATA_SIZE - 1 : size - 1;
+
+		remaining[passes[k]]++;
+		for(int r = first / stride; r <= last / stride; r++) missing[r]++;
+	}
+
+	log("Starting progressive packet reading...\n");
+	while(got < count)
+	{
+		int n = radio_packet_receive(fd, read_buf, -1);
+		if(n == -1)
+		{
+			log("Radio Link Closed.\n");
+			status = -1;
+			break;
+		}
+
+		// Check that you got the correct number of bytes and correct checksum
+		if(packet_verify_format(packet, n) != 1)
+		{
+			log("Invalid Packet Recieved (%d Bytes). Writing NACK...\n", n);
+			packet_size = packet_data_nack_create(write_buf, 0, count);
+			write(fd, write_buf, packet_size);
+			continue;
+		}
+		if((packet->type & ITP_TYPE_MASK) != ITP_TYPE_DATA_SEND || packet->seqnum >= count) continue;
+
+		// Only add data to buffer if it is newer
+		int seqnum = packet->seqnum;
+		int cancel = 0;
+		if(!received[seqnum])
+		{
+			int first = seqnum * MAX_DATA_SIZE;
+			int len = packet_data_size(packet);
+			if(first + len > size) len = size - first;
+
+			// The final packet carries the digest of the whole transfer
+			if(seqnum == count - 1) memcpy(final_buf, packet, n);
+
+			memcpy(data + first, &packet->data, len);
+			received[seqnum] = 1;
+			got++;
+
+			// Show every row that this chunk completed
+			for(int r = first / stride; r <= (first + len - 1) / stride; r++)
+			{
+				if(--missing[r] == 0)
+				{
+					progressive_preview_row(image, data, preview, complete, r);
+				}
+			}
+
+			// Let the operator look at each finished pass
+			int pass = passes[seqnum];
+			if(--remaining[pass] == 0)
+			{
+				log("Pass %d Recieved (%d of %d Chunks).\n", pass, got, count);
+				if(callback != NULL && callback(pass, preview, arg) != 0)
+				{
+					cancel = 1;
+				}
+			}
+		}
+
+		// Chunks arrive out of order, so the digest is checked once at the end
+		if(got == count && !packet_digest_ok((struct packet*) final_buf, crc32c_update(0, data, size)))
+		{
+			log("Transfer Digest Mismatch.\n");
+			cancel = 1;
+		}
+
+		if(cancel)
+		{
+			log("Progressive Transfer Cancelled. Writing Error...\n");
+			packet_size = packet_data_err_create(write_buf);
+			write(fd, write_buf, packet_size);
+			status = -1;
+			break;
+		}
+
+		// Sent acknowledgement of current packet (This must send even if a redundant packet was sent)
+		packet_size = packet_data_ack_create(write_buf, seqnum, count);
+		write(fd, write_buf, packet_size);
+	}
+
+	if(status == 0) log("Reading Complete.\n");
+
+	free(order);
+	free(passes);
+	free(received);
+	free(complete);
+	free(missing);
+	return status == 0 ? size : -1;
+}
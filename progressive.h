@@ -0,0 +1,38 @@
+/******************************************************************************
+ * File: progressive.h
+ *
+ * Description: Describes progressive image transfers which send the rows of
+ *              an image in interlaced passes so that the receiver can show a
+ *              coarse preview long before the transfer is complete
+ *****************************************************************************/
+#pragma once
+#include <stdint.h>
+
+#define PROGRESSIVE_PASSES 4
+
+/******************************************************************************
+ * The layout of the image being transferred. Both ends must use the same one.
+ *****************************************************************************/
+struct progressive_image
+{
+	int  width;       // Image width in pixels
+	int  height;      // Image height in rows
+	int  bpp;         // Bytes per pixel
+	int  roi_top;     // First row of the region of interest
+	int  roi_bottom;  // One past the last row of the region (roi_top = none)
+};
+
+/******************************************************************************
+ * Called by the receiver each time a pass is complete. The preview holds the
+ * whole image with missing rows filled from the nearest row above. Returning
+ * nonzero cancels the transfer.
+ *****************************************************************************/
+typedef int (*progressive_callback)(int pass, uint8_t* preview, void* arg);
+
+/******************************************************************************
+ * Progressive transfer functions
+ *****************************************************************************/
+int progressive_row_pass(int row);
+int progressive_order(const struct progressive_image* image, uint16_t* order, uint8_t* passes);
+int progressive_send(int fd, const struct progressive_image* image, uint8_t* data);
+int progressive_receive(int fd, const struct progressive_image* image, uint8_t* data, uint8_t* preview, progressive_callback callback, void* arg);
@@ -6,9 +6,15 @@
 #include <stdio.h>   /* Printing functions */
 #include <string.h>  /* Used for memory copies */
 #include <poll.h>
+#include <sys/ioctl.h> /* Serial driver control */
+#ifdef __linux__
+#include <linux/serial.h> /* ASYNC_LOW_LATENCY */
+#endif
 
 #include "packet.h"
 #include "radio.h"
+#include "arena.h"
+#include "crc32c.h"
 #include "log.h"
 
 /******************************************************************************
@@ -29,7 +35,8 @@ int radio_open(const char* device)
 	}
 	else
 	{
-		fcntl(fd, F_SETFL, 1); // Use blocking behavior
+		// Use blocking behavior (O_NDELAY was only needed to skip waiting for DCD on open)
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NDELAY);
 	}
 
 	log("Radio Device Opened.\n");
@@ -77,6 +84,78 @@ void radio_config(int fd, int baud)
 	log("Radio Configured.\n");
 }
 
+/******************************************************************************
+ * Asks the serial driver to push received bytes to the reader immediately
+ * instead of batching them. Not all drivers support this (USB adapters and
+ * pseudo terminals may not), so failure is only logged. Private.
+ *
+ * @param     fd      The file descriptor to the radio device
+ *
+ * @return    If low latency mode was enabled
+ *****************************************************************************/
+int radio_low_latency(int fd)
+{
+#if defined(__linux__) && defined(ASYNC_LOW_LATENCY)
+	struct serial_struct serial;
+
+	if(ioctl(fd, TIOCGSERIAL, &serial) == 0)
+	{
+		serial.flags |= ASYNC_LOW_LATENCY;
+		if(ioctl(fd, TIOCSSERIAL, &serial) == 0)
+		{
+			return 1;
+		}
+	}
+#endif
+	log("Warning: Serial low latency mode not supported.\n");
+	return 0;
+}
+
+/******************************************************************************
+ * Initializes the serial options for the lowest latency. Unlike radio_config
+ * every input, output and line processing option is cleared, so no byte of a
+ * packet is translated (ICRNL, ONLCR) or swallowed as flow control (IXON).
+ * Reads return as soon as one byte is available since timeouts are handled
+ * with poll.
+ *
+ * @param     fd      The file descriptor to the radio device
+ * @param     baud    The baud rate to set the serial output to
+ *****************************************************************************/
+void radio_config_raw(int fd, int baud)
+{
+	struct termios options;
+
+	// Get current attributes
+	tcgetattr(fd, &options);
+
+	// Clear all input, output and line processing and set 8 data bits
+	cfmakeraw(&options);
+
+	// Change intput/output baud rate
+	cfsetispeed(&options, baud);
+	cfsetospeed(&options, baud);
+
+	// CSTOPB | Use 1 stop bit
+	options.c_cflag &= ~CSTOPB;
+
+	// CLOCAL | Do not change own of port
+	// CREAD  | Enable receiver
+	options.c_cflag |= (CLOCAL | CREAD);
+
+	// VMIN   | Return from read once a single byte is available
+	// VTIME  | Do not wait for further bytes
+	options.c_cc[VMIN] = 1;
+	options.c_cc[VTIME] = 0;
+
+	// Set the attributes and drop anything received under the old settings
+	tcsetattr(fd, TCSANOW, &options);
+	tcflush(fd, TCIOFLUSH);
+
+	radio_low_latency(fd);
+
+	log("Radio Configured (Raw).\n");
+}
+
 /******************************************************************************
  * Checks to see if data is available to read on the radio device file
  * descriptor. Allows a time to be specified before giving up. Private.
@@ -115,7 +194,7 @@ int radio_data_poll(int fd, int timeout)
  * @param     fd      The file descriptor for the radio device
  * @param     data    The data buffer to fill
  *
- * @return    The number of bytes recieved
+ * @return    The number of bytes recieved (-1 = device closed or read error)
  *****************************************************************************/
 int radio_data_read(int fd, uint8_t* data)
 {
@@ -123,13 +202,18 @@ int radio_data_read(int fd, uint8_t* data)
 	int expected = sizeof(struct packet);          // Bytes expected to be recieved
 	struct packet* packet = (struct packet*) data; // Packet Pointer (For ease of use)
 	int poll_timeout = 100;                        // Amount of time to wait before giving up
+	int n;
 
-	// Read into the data buffer while while we do not have a complete buffer
+	// Read into the data buffer while while we do not have a complete buffer.
+	// Only the bytes of the current packet are consumed so that any packet
+	// queued behind it is left for the next read.
 	while(total < expected)
 	{
 		if(radio_data_poll(fd, poll_timeout))
 		{
-			total += read(fd, data, MAX_BUFFER_SIZE);
+			n = read(fd, data + total, expected - total);
+			if(n <= 0) return -1; // Device closed or read error
+			total += n;
 		}
 		else
 		{
@@ -138,15 +222,20 @@ int radio_data_read(int fd, uint8_t* data)
 	}
 
 	// If we are getting data, read the data as well
-	if(packet->type == ITP_TYPE_DATA_SEND)
+	if((packet->type & ITP_TYPE_MASK) == ITP_TYPE_DATA_SEND)
 	{
 		expected += packet->size - 1;
+
+		// A corrupt size field can not be trusted, let the format check fail
+		if(expected > MAX_BUFFER_SIZE) return total;
 		
 		while(total < expected)
 		{
 			if(radio_data_poll(fd, poll_timeout))
 			{
-				total += read(fd, data, MAX_BUFFER_SIZE);
+				n = read(fd, data + total, expected - total);
+				if(n <= 0) return -1; // Device closed or read error
+				total += n;
 			}
 			else
 			{
@@ -159,97 +248,158 @@ int radio_data_read(int fd, uint8_t* data)
 }
 
 /******************************************************************************
- * Write the data buffer in chunks.
+ * Waits for a packet to arrive on the radio device and reads it. Unlike the
+ * chunk functions this does not warn when nothing arrives, which makes it
+ * suitable for idle links.
+ *
+ * @param     fd       The file descriptor for the radio device
+ * @param     buf      The packet buffer to fill (MAX_BUFFER_SIZE bytes)
+ * @param     timeout  The amount of time to wait in milliseconds (-1 = forever)
+ *
+ * @return    The number of bytes recieved (0 = nothing recieved, -1 = error)
+ *****************************************************************************/
+int radio_packet_receive(int fd, uint8_t* buf, int timeout)
+{
+	struct pollfd pfd = {fd, POLLIN | POLLPRI, 0};
+
+	if(poll(&pfd, 1, timeout) <= 0)
+	{
+		return 0;
+	}
+
+	return radio_data_read(fd, buf);
+}
+
+/******************************************************************************
+ * Sends a single prepared data packet and waits for it to be acknowledged.
+ * The packet is retransmitted on timeouts, invalid replies and NACKs. Replies
+ * that belong to another stream or an older sequence number are stale and are
+ * ignored.
  *
  * @param     fd      The file descriptor to the radio device
- * @param     data    The data to send
- * @param     size    The size of the data to send
+ * @param     buf     The data packet to send
+ * @param     size    The size of the data packet
  *
  * @return    If transfer was successful (0 = success, -1 = failure)
  *****************************************************************************/
-int radio_data_send(int fd, uint8_t* data, int size)
+int radio_packet_send(int fd, uint8_t* buf, int size)
 {
-	// Allocate packet buffers
-	uint8_t write_buf[MAX_BUFFER_SIZE] = {0};
+	// Allocate reply buffer
 	uint8_t read_buf[MAX_BUFFER_SIZE] = {0};
 	struct packet* packet = (struct packet*) read_buf;
-
-	// Determine sizing
-	int data_size = MAX_DATA_SIZE;
-	uint16_t num_packets = size / data_size;
+	struct packet* sent = (struct packet*) buf;
 	int n;
 
-	// Send chunks
-	log("Starting packet writing...\n");
-	for(int i = 0; i < num_packets; ++i)
+	while(1)
 	{
-		// Ensure correct data size when at the end of data
-		if(i+1 == num_packets)
-		{
-			data_size = (size - (MAX_DATA_SIZE*i));
-		}
-		
-		// Create packet
-		int packet_size = packet_data_send_create(write_buf, data + (MAX_DATA_SIZE* i), data_size, i, num_packets);
-
-		// Send the packet and wait for an ACK
-		int ack_received = 0;
-		while(ack_received == 0)
-		{			
-			// Send the data chunk
-			n = write(fd, write_buf, packet_size);
-			log("Wrote data chunk - %d of %d (%d Bytes).\n", i+1, num_packets, n);
+		// Send the data chunk
+		n = write(fd, buf, size);
+		log("Wrote data chunk - %d of %d (%d Bytes).\n", sent->seqnum+1, sent->total, n);
 
-			// Retry on error
-			if(n != packet_size) continue;
+		// Retry on error
+		if(n != size) continue;
 
+		// Wait for a reply to this packet
+		int resend = 0;
+		while(resend == 0)
+		{
 			// Attempt to read ACK packet
 			n = radio_data_read(fd, read_buf);
-			
+
 			// Check that you got the correct number of bytes and correct checksum
-			if(packet_verify_format(packet, n) == 1)
+			if(packet_verify_format(packet, n) != 1)
 			{
-				// Check that it is an ACK and not a NACK
-				switch(packet->type)
-				{
-					case ITP_TYPE_DATA_ACK:
-						log("ACK Recieved.\n");
-						ack_received = 1;
-						break;
-				
-					case ITP_TYPE_DATA_NACK:
-						log("NACK Recieved. Retry...\n");
-						// TODO: Set current chunk to be sent to the value found in the NACK packet
-						continue; // Attempt again
-
-					case ITP_TYPE_DATA_ERR:
-						log("Error Recieved. Exiting.\n");
-						return -1; // Irrecoverable
-
-					default:
-						log("Unknown Packet Type: 0x%X. Exiting.\n", packet->type);
-						return -1; // Irrecoverable
-				}
+				log("Invalid Packet Recieved (%d Bytes).\n", n);
+				resend = 1;
+				break;
 			}
-			else
+
+			// Ignore replies meant for another transfer
+			if(packet->stream != sent->stream && packet->type != ITP_TYPE_DATA_ERR)
 			{
-				log("Invalid Packet Recieved (%d Bytes).\n", n);
+				log("Stale Reply for Stream %d Ignored.\n", packet->stream);
+				continue;
+			}
+
+			// Check that it is an ACK and not a NACK
+			switch(packet->type)
+			{
+				case ITP_TYPE_DATA_ACK:
+					if(packet->seqnum != sent->seqnum)
+					{
+						log("Stale ACK Recieved (%d).\n", packet->seqnum+1);
+						continue; // Keep waiting for the current ACK
+					}
+					log("ACK Recieved.\n");
+					return 0;
+			
+				case ITP_TYPE_DATA_NACK:
+					log("NACK Recieved. Retry...\n");
+					// TODO: Set current chunk to be sent to the value found in the NACK packet
+					resend = 1;
+					break; // Attempt again
+
+				case ITP_TYPE_DATA_ERR:
+					log("Error Recieved. Exiting.\n");
+					return -1; // Irrecoverable
+
+				default:
+					log("Unknown Packet Type: 0x%X. Exiting.\n", packet->type);
+					return -1; // Irrecoverable
 			}
 		}
 	}
+}
+
+/******************************************************************************
+ * Write the data buffer in chunks.
+ *
+ * @param     fd      The file descriptor to the radio device
+ * @param     data    The data to send
+ * @param     size    The size of the data to send
+ *
+ * @return    If transfer was successful (0 = success, -1 = failure)
+ *****************************************************************************/
+int radio_data_send(int fd, uint8_t* data, int size)
+{
+	struct arena arena;
+
+	// Build every packet up front so retries do not rebuild them
+	if(arena_build(&arena, data, size, 0, 0) != 0)
+	{
+		return -1;
+	}
+
+	// Send chunks
+	log("Starting packet writing...\n");
+	for(int i = 0; i < arena.count; ++i)
+	{
+		int packet_size;
+		uint8_t* packet = arena_frame(&arena, i, &packet_size);
+
+		// Send the packet and wait for an ACK
+		if(radio_packet_send(fd, packet, packet_size) != 0)
+		{
+			arena_free(&arena);
+			return -1; // Irrecoverable
+		}
+	}
 	log("Writing Complete.\n");
+
+	arena_free(&arena);
 	return 0;
 }
 
 
 /******************************************************************************
  * Read radio transmission chunk data to a data buffer. Image data is
- * transmitted in chunks in order to ensure data correctness
+ * transmitted in chunks in order to ensure data correctness. The whole
+ * transfer is checked against the digest in the final packet.
  *
  * @param     fd      The file descriptor to the radio device
  * @param     data    The data buffer to fill
  *
- * @return    The number of bytes recieved
+ * @return    The number of bytes recieved (-1 = digest mismatch)
  *****************************************************************************/
 int radio_data_receive(int fd, uint8_t* data)
 {
@@ -265,6 +415,7 @@ int radio_data_receive(int fd, uint8_t* data)
 	int current = 0;          // The current data chunk to receive
 	int final = -1;           // The last data chunk to receive
 	uint8_t* data_ptr = data; // Pointer to the end of the data buffer
+	uint32_t digest = 0;      // CRC32C digest of the data recieved so far
 
 	// Loop until all packets have been received
 	log("Starting packet reading...\n");
@@ -293,24 +444,37 @@ int radio_data_receive(int fd, uint8_t* data)
 				continue;
 			}
 
-			log("Writing ACK.\n");
-			// Sent acknowledgement of current packet (This must send even if a redundant packet was sent)
-			int packet_size = packet_data_ack_create(write_buf, packet->seqnum, final);
-			n = write(fd, write_buf, packet_size);
-
 			// Only add data to buffer if it is newer
 			if(packet->seqnum == current)
 			{
+				int size = packet_data_size(packet);
+
 				// Increment the current counter
 				current++;
 
 				// Append data buffer with the new data
-				memcpy(data_ptr, &packet->data, packet->size);
+				memcpy(data_ptr, &packet->data, size);
+
+				// Add the new data to the transfer digest while it is in cache
+				digest = crc32c_update(digest, data_ptr, size);
 
 				// Move the data pointer
-				data_ptr += packet->size;
+				data_ptr += size;
+
+				// The final packet carries the digest of the whole transfer
+				if(!packet_digest_ok(packet, digest))
+				{
+					log("Transfer Digest Mismatch. Writing Error...\n");
+					int packet_size = packet_data_err_create(write_buf);
+					n = write(fd, write_buf, packet_size);
+					return -1;
+				}
 			}
 
+			log("Writing ACK.\n");
+			// Sent acknowledgement of current packet (This must send even if a redundant packet was sent)
+			int packet_size = packet_data_ack_create(write_buf, packet->seqnum, final);
+			n = write(fd, write_buf, packet_size);
 		}
 		else
 		{
@@ -14,5 +14,8 @@
  *****************************************************************************/
 int radio_open(const char* device);
 void radio_config(int fd, int baud);
+void radio_config_raw(int fd, int baud);
 int radio_data_send(int fd, uint8_t* data, int size);
 int radio_data_receive(int fd, uint8_t* data);
+int radio_packet_send(int fd, uint8_t* buf, int size);
+int radio_packet_receive(int fd, uint8_t* buf, int timeout);
@@ -0,0 +1,455 @@
+#include <string.h>  /* Used for memory copies */
+
+#include "packet.h"
+#include "radio.h"
+#include "session.h"
+#include "crc32c.h"
+#include "log.h"
+
+/******************************************************************************
+ * Initializes a session on an open radio device. Every incoming transfer is
+ * recieved into the same data buffer, so the callback has to use the data
+ * before the next transfer arrives.
+ *
+ * @param     session   The session to initialize
+ * @param     fd        The file descriptor to the radio device
+ * @param     data      The data buffer to fill with incoming transfers
+ * @param     size      The size of the data buffer
+ * @param     callback  Called with every completed incoming transfer (May be NULL)
+ * @param     arg       Passed to the callback
+ *****************************************************************************/
+void session_init(struct session* session, int fd, uint8_t* data, int size, session_callback callback, void* arg)
+{
+	memset(session, 0, sizeof(*session));
+	session->fd = fd;
+	aggregate_init(&session->ag, fd, AGGREGATE_MAX_SIZE);
+	session->callback = callback;
+	session->arg = arg;
+	session->rx_data = data;
+	session->rx_size = size;
+	session->rx_total = -1;
+}
+
+/******************************************************************************
+ * Starts the next queued outgoing transfer once the current one is done.
+ * Private.
+ *
+ * @param     session  The session
+ *****************************************************************************/
+void session_tx_start(struct session* session)
+{
+	while(!session->tx_active && session->tx_queued > 0)
+	{
+		int packet_size;
+
+		session->tx = session->tx_queue[0];
+		session->tx_queued--;
+		memmove(&session->tx_queue[0], &session->tx_queue[1], sizeof(struct arena) * session->tx_queued);
+
+		// Empty transfers have nothing to send
+		if(session->tx.count == 0)
+		{
+			arena_free(&session->tx);
+			continue;
+		}
+
+		session->tx_active = 1;
+		session->tx_stream = ((struct packet*) arena_frame(&session->tx, 0, &packet_size))->stream;
+		session->tx_next = 0;
+		session->tx_sent = 0;
+	}
+}
+
+/******************************************************************************
+ * Queues an outgoing transfer on the session. The data is copied, and queued
+ * transfers are sent one after another while the session is polled.
+ *
+ * @param     session  The session
+ * @param     data     The data to send
+ * @param     size     The size of the data
+ *
+ * @return    If the transfer was queued (0 = success, -1 = failure)
+ *****************************************************************************/
+int session_send(struct session* session, uint8_t* data, int size)
+{
+	if(session->tx_closed)
+	{
+		log("Session Closing. Transfer Not Queued.\n");
+		return -1;
+	}
+	if(session->tx_queued == SESSION_MAX_QUEUE)
+	{
+		log("Session Busy. Transfer Not Queued.\n");
+		return -1;
+	}
+
+	// Consecutive transfers use different streams so the receiver can tell them apart
+	if(++session->tx_streams == 0) session->tx_streams = 1;
+
+	if(arena_build(&session->tx_queue[session->tx_queued], data, size, session->tx_streams, 0) != 0)
+	{
+		return -1;
+	}
+
+	session->tx_queued++;
+	session_tx_start(session);
+	return 0;
+}
+
+/******************************************************************************
+ * Handles an acknowledgement of outgoing data, whether it arrived on its own
+ * or on a data packet. Private.
+ *
+ * @param     session  The session
+ * @param     seqnum   The data packet that was acknowledged
+ *****************************************************************************/
+void session_acked(struct session* session, uint16_t seqnum)
+{
+	// Ignore ACKs of data packets that were already acknowledged
+	if(!session->tx_active || seqnum != session->tx_next) return;
+
+	session->tx_next++;
+	session->tx_sent = 0;
+
+	if(session->tx_next == session->tx.count)
+	{
+		log("Session Writing Complete.\n");
+		arena_free(&session->tx);
+		session->tx_active = 0;
+		session_tx_start(session);
+	}
+}
+
+/******************************************************************************
+ * Handles an incoming data packet and schedules its acknowledgement. The ACK
+ * is held back for a short time in case outgoing data can carry it, unless
+ * there is no outgoing data to wait for. A new transfer starts on a new
+ * stream once the last one is complete, and the final packet of every
+ * transfer is checked against its digest. Private.
+ *
+ * @param     session  The session
+ * @param     packet   The data packet
+ * @param     now      The current time in milliseconds
+ *
+ * @return    If the data was accepted (0 = success, -1 = digest mismatch)
+ *****************************************************************************/
+int session_deliver(struct session* session, struct packet* packet, uint64_t now)
+{
+	// Start the next transfer once the current one is complete
+	if(packet->stream != session->rx_stream || session->rx_total == -1)
+	{
+		if(packet->stream == 0 || packet->seqnum != 0) return 0;
+		if(session->rx_total != -1 && session->rx_next != session->rx_total) return 0;
+
+		session->rx_stream = packet->stream;
+		session->rx_total = packet->total;
+		session->rx_next = 0;
+		session->rx_len = 0;
+		session->rx_digest = 0;
+	}
+
+	// Data packets are sent one at a time, anything ahead is bogus
+	if(packet->seqnum > session->rx_next) return 0;
+
+	// Only add data to buffer if it is newer
+	if(packet->seqnum == session->rx_next)
+	{
+		int size = packet_data_size(packet);
+		if(session->rx_len + size <= session->rx_size)
+		{
+			uint8_t* ptr = session->rx_data + session->rx_len;
+			memcpy(ptr, &packet->data, size);
+			session->rx_digest = crc32c_update(session->rx_digest, ptr, size);
+			session->rx_len += size;
+		}
+		session->rx_next++;
+
+		// The final packet carries the digest of the whole transfer
+		if(!packet_digest_ok(packet, session->rx_digest))
+		{
+			log("Transfer Digest Mismatch.\n");
+			return -1;
+		}
+
+		log("Session read data chunk - %d of %d.\n", session->rx_next, session->rx_total);
+		if(session->rx_next == session->rx_total)
+		{
+			log("Session Reading Complete (%d Bytes).\n", session->rx_len);
+			session->rx_count++;
+			if(session->callback != NULL)
+			{
+				session->callback(session->rx_data, session->rx_len, session->arg);
+			}
+		}
+	}
+
+	// Acknowledge the newest in order data packet (Also sent for resends)
+	if(!session->ack_pending)
+	{
+		session->ack_due = session->tx_active ? now + SESSION_DELAYED_ACK_MS : now;
+	}
+	session->ack_pending = 1;
+	session->ack_seqnum = session->rx_next - 1;
+	return 0;
+}
+
+/******************************************************************************
+ * Handles one incoming packet. Any reply is queued on the outgoing
+ * super-frame. Private.
+ *
+ * @param     session  The session
+ * @param     packet   The packet
+ * @param     size     The size of the packet
+ * @param     now      The current time in milliseconds
+ *
+ * @return    If the session is still usable (0 = success, -1 = failure)
+ *****************************************************************************/
+int session_packet(struct session* session, struct packet* packet, int size, uint64_t now)
+{
+	uint8_t write_buf[MAX_BUFFER_SIZE] = {0};
+	int packet_size;
+
+	// The sender resends on its own, so bad packets are only dropped
+	if(packet_verify_format(packet, size) != 1)
+	{
+		log("Invalid Packet Recieved (%d Bytes).\n", size);
+		return 0;
+	}
+
+	switch(packet->type & ITP_TYPE_MASK)
+	{
+		case ITP_TYPE_DATA_ACK:
+			// Stream 0 acknowledges the end of session
+			if(packet->stream == 0)
+			{
+				if(session->fin_sent) session->fin_acked = 1;
+			}
+			else if(packet->stream == session->tx_stream)
+			{
+				session_acked(session, packet->seqnum);
+			}
+			break;
+
+		case ITP_TYPE_DATA_FIN:
+			// Only accepted between transfers, the other end resends it
+			if(session->rx_total != -1 && session->rx_next != session->rx_total) break;
+
+			session->peer_fin = 1;
+			packet_size = packet_data_ack_create(write_buf, 0, 0);
+			aggregate_queue(&session->ag, write_buf, packet_size);
+			break;
+
+		case ITP_TYPE_DATA_SEND:
+			// Only an ACK of the current outgoing transfer moves it along
+			if((packet->type & ITP_FLAG_ACK) && packet->ack_stream == session->tx_stream)
+			{
+				session_acked(session, packet->ack);
+			}
+			if(session_deliver(session, packet, now) != 0)
+			{
+				packet_size = packet_data_err_create(write_buf);
+				aggregate_queue(&session->ag, write_buf, packet_size);
+				return -1; // Irrecoverable
+			}
+			break;
+
+		case ITP_TYPE_DATA_NACK:
+			// Resend right away
+			session->tx_sent = 0;
+			break;
+
+		case ITP_TYPE_DATA_ERR:
+			log("Error Recieved. Exiting.\n");
+			return -1; // Irrecoverable
+
+		default:
+			log("Unknown Packet Type: 0x%X.\n", packet->type);
+			break;
+	}
+
+	return 0;
+}
+
+/******************************************************************************
+ * Runs one step of the session. The current outgoing data packet (sent again
+ * after a timeout) carries any pending ACK. A pending ACK is sent on its own
+ * once its delay runs out. The end of session is sent once the session is
+ * closing and everything was sent. Everything due goes out as one
+ * super-frame, and then one incoming super-frame is handled.
+ *
+ * @param     session  The session
+ * @param     timeout  The longest time to wait for a packet in milliseconds
+ *
+ * @return    If the session is still usable (0 = success, -1 = failure)
+ *****************************************************************************/
+int session_poll(struct session* session, int timeout)
+{
+	// Allocate packet buffers
+	uint8_t write_buf[MAX_BUFFER_SIZE] = {0};
+	uint32_t frame[AGGREGATE_MAX_SIZE / 4]; // Keeps the packets in the frame aligned
+	uint8_t* read_buf = (uint8_t*) frame;
+	uint64_t now = log_time_us() / 1000;
+	int packet_size;
+	int n;
+
+	// Queue the current data packet
+	if(session->tx_active && (!session->tx_sent || now >= session->tx_time + SESSION_TIMEOUT_MS))
+	{
+		uint8_t* ptr = arena_frame(&session->tx, session->tx_next, &packet_size);
+		memcpy(write_buf, ptr, packet_size);
+
+		if(session->ack_pending)
+		{
+			packet_set_ack(write_buf, session->rx_stream, session->ack_seqnum);
+			session->ack_pending = 0;
+			session->piggybacked++;
+		}
+
+		aggregate_queue(&session->ag, write_buf, packet_size);
+		log("Session queued data chunk - %d of %d (%d Bytes).\n", session->tx_next+1, session->tx.count, packet_size);
+
+		session->tx_sent = 1;
+		session->tx_time = now;
+	}
+
+	// Queue the ACK on its own if no data packet came along to carry it
+	if(session->ack_pending && now >= session->ack_due)
+	{
+		packet_size = packet_data_ack_create(write_buf, session->ack_seqnum, session->rx_total);
+		packet_set_stream(write_buf, session->rx_stream);
+		aggregate_queue(&session->ag, write_buf, packet_size);
+
+		session->ack_pending = 0;
+		session->standalone++;
+	}
+
+	// Tell the other end there is nothing more to send (Resent until acknowledged)
+	if(session->tx_closed && !session->tx_active && !session->fin_acked &&
+	   (!session->fin_sent || now >= session->fin_time + SESSION_TIMEOUT_MS))
+	{
+		if(session->fin_sent == SESSION_FIN_RETRIES)
+		{
+			log("Warning: End of Session Not Acknowledged.\n");
+			session->fin_acked = 1;
+		}
+		else
+		{
+			packet_size = packet_data_fin_create(write_buf);
+			aggregate_queue(&session->ag, write_buf, packet_size);
+
+			session->fin_sent++;
+			session->fin_time = now;
+		}
+	}
+
+	// Lost super-frames are covered by the resend timers
+	if(aggregate_flush(&session->ag) != 0)
+	{
+		log("Unable to Write Super-Frame.\n");
+	}
+
+	// Wake up in time for the next timer
+	if(session->tx_active)
+	{
+		int left = (int) (session->tx_time + SESSION_TIMEOUT_MS - now);
+		if(left < timeout) timeout = left;
+	}
+	if(session->ack_pending)
+	{
+		int left = (int) (session->ack_due - now);
+		if(left < timeout) timeout = left;
+	}
+	if(session->fin_sent && !session->fin_acked)
+	{
+		int left = (int) (session->fin_time + SESSION_TIMEOUT_MS - now);
+		if(left < timeout) timeout = left;
+	}
+	if(timeout < 0) timeout = 0;
+
+	n = aggregate_read(session->fd, read_buf, timeout);
+	if(n == -1)
+	{
+		log("Radio Link Closed.\n");
+		return -1;
+	}
+
+	int offset = 0;
+	int size;
+	uint8_t* packet;
+	int status = 0;
+
+	now = log_time_us() / 1000;
+	while(status == 0 && (packet = aggregate_next(read_buf, n, &offset, &size)) != NULL)
+	{
+		status = session_packet(session, (struct packet*) packet, size, now);
+	}
+
+	// Replies to the incoming packets go back together
+	aggregate_flush(&session->ag);
+	return status;
+}
+
+/******************************************************************************
+ * Checks if both directions of the session are finished: every outgoing
+ * transfer and the end of session were acknowledged, the other end has sent
+ * its end of session and the last ACK was sent.
+ *
+ * @param     session  The session
+ *
+ * @return    If the session is finished
+ *****************************************************************************/
+int session_done(struct session* session)
+{
+	return !session->tx_active && session->fin_acked &&
+	       session->peer_fin && !session->ack_pending;
+}
+
+/******************************************************************************
+ * Closes the session to new transfers and runs it until both directions are
+ * finished. A side with nothing to send only sends its end of session.
+ * Afterwards the session keeps answering for a short time in case the final
+ * ACK was lost and the other end resends its last packet.
+ *
+ * @param     session  The session
+ *
+ * @return    If the session was successful (0 = success, -1 = failure)
+ *****************************************************************************/
+int session_run(struct session* session)
+{
+	session->tx_closed = 1;
+
+	while(!session_done(session))
+	{
+		if(session_poll(session, SESSION_TIMEOUT_MS) != 0)
+		{
+			return -1;
+		}
+	}
+
+	uint64_t end = log_time_us() / 1000 + SESSION_LINGER_MS;
+	while(log_time_us() / 1000 < end)
+	{
+		if(session_poll(session, SESSION_LINGER_MS) != 0) break;
+	}
+
+	log("Session Complete (%d Transfers Recieved, %d ACKs Piggybacked, %d Standalone).\n",
+	    session->rx_count, session->piggybacked, session->standalone);
+	return 0;
+}
+
+/******************************************************************************
+ * Releases the memory held by a session.
+ *
+ * @param     session  The session
+ *****************************************************************************/
+void session_close(struct session* session)
+{
+	arena_free(&session->tx);
+	session->tx_active = 0;
+
+	for(int i = 0; i < session->tx_queued; i++)
+	{
+		arena_free(&session->tx_queue[i]);
+	}
+	session->tx_queued = 0;
+}
@@ -0,0 +1,79 @@
+/******************************************************************************
+ * File: session.h
+ *
+ * Description: Describes bidirectional ITP sessions where both ends send data
+ *              and acknowledgements ride on reverse direction data packets
+ *****************************************************************************/
+#pragma once
+#include <stdint.h>
+
+#include "arena.h"
+#include "aggregate.h"
+
+#define SESSION_TIMEOUT_MS     100 // Time to wait for an ACK before resending
+#define SESSION_DELAYED_ACK_MS 20  // Time to hold an ACK for a data packet to carry it
+#define SESSION_LINGER_MS      200 // Time to keep answering resends once finished
+#define SESSION_MAX_QUEUE      8   // Outgoing transfers that can wait their turn
+#define SESSION_FIN_RETRIES    10  // Times to send the end of session before giving up
+
+/******************************************************************************
+ * Called with every incoming transfer once it is complete
+ *****************************************************************************/
+typedef void (*session_callback)(uint8_t* data, int size, void* arg);
+
+/******************************************************************************
+ * A bidirectional session over one radio device
+ *****************************************************************************/
+struct session
+{
+	int           fd;           // The file descriptor to the radio device
+	struct aggregate ag;        // Outgoing packets sent together each step
+	session_callback callback;  // Called with every completed incoming transfer
+	void*         arg;          // Passed to the callback
+
+	// Outgoing transfers
+	struct arena  tx;           // Every data packet of the outgoing transfer
+	int           tx_active;    // If an outgoing transfer is in progress
+	uint8_t       tx_stream;    // The stream of the outgoing transfer
+	uint16_t      tx_next;      // The data packet waiting for an ACK
+	int           tx_sent;      // If that data packet has been sent
+	uint64_t      tx_time;      // When it was last sent in milliseconds
+	struct arena  tx_queue[SESSION_MAX_QUEUE]; // Transfers waiting their turn
+	int           tx_queued;    // Number of transfers waiting
+	uint8_t       tx_streams;   // The stream given to the last queued transfer
+
+	// End of session
+	int           tx_closed;    // If no more transfers will be queued
+	int           fin_sent;     // Times the end of session was sent
+	uint64_t      fin_time;     // When it was last sent in milliseconds
+	int           fin_acked;    // If the other end acknowledged it
+	int           peer_fin;     // If the other end has no more data to send
+
+	// Incoming transfers
+	uint8_t*      rx_data;      // The data buffer to fill
+	int           rx_size;      // The size of the data buffer
+	int           rx_len;       // The number of bytes recieved
+	uint8_t       rx_stream;    // The stream of the incoming transfer (0 = none yet)
+	uint16_t      rx_next;      // The next data packet to receive
+	int           rx_total;     // Total data packets (-1 = not started)
+	uint32_t      rx_digest;    // CRC32C digest of the data recieved so far
+	int           rx_count;     // Incoming transfers completed
+
+	// Acknowledgement of incoming data
+	int           ack_pending;  // If an ACK still has to be sent
+	uint16_t      ack_seqnum;   // The data packet to acknowledge
+	uint64_t      ack_due;      // When to stop waiting for a data packet to carry it
+
+	int           piggybacked;  // ACKs carried by data packets
+	int           standalone;   // ACKs sent on their own
+};
+
+/******************************************************************************
+ * Session functions
+ *****************************************************************************/
+void session_init(struct session* session, int fd, uint8_t* data, int size, session_callback callback, void* arg);
+int session_send(struct session* session, uint8_t* data, int size);
+int session_poll(struct session* session, int timeout);
+int session_done(struct session* session);
+int session_run(struct session* session);
+void session_close(struct session* session);
@@ -2,6 +2,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <pty.h>
 
 #include <sys/types.h> 
 #include <sys/socket.h>
@@ -9,6 +13,8 @@
 #include <arpa/inet.h>
 
 #include "sim.h"
+#include "packet.h"
+#include "radio.h"
 #include "log.h"
 
 /******************************************************************************
@@ -78,6 +84,43 @@ int sim_tcp_server_socket()
     return sockfd;
 }
 
+/******************************************************************************
+ * Creates several server TCP sockets for simulating multiple radio devices.
+ * Clients connect to the same port once per radio device.
+ *
+ * @param     fds    The array to fill with the simulation radio devices
+ * @param     count  The number of radio devices to accept
+ *
+ * @return    The number of radio devices created
+ *****************************************************************************/
+int sim_tcp_server_sockets(int* fds, int count)
+{
+    int listen_sock;
+
+    /* Create listen socket */
+    listen_sock = sim_tcp_listen_socket();
+
+    /* Listen for connection requests */
+    listen(listen_sock, count);
+
+    /* Accept one connection per radio device */
+    for (int i = 0; i < count; i++)
+    {
+        fds[i] = accept(listen_sock, (struct sockaddr *) NULL, NULL);
+        if (fds[i] < 0) 
+        {
+            log_error("TCP Accept");
+            exit(1);
+        }
+    }
+
+    /* Close the listen port */
+    close(listen_sock);
+
+    log("%d TCP Sockets Created.\n", count);
+    return count;
+}
+
 /******************************************************************************
  * Creates the client TCP socket for simulation.
  *
@@ -117,4 +160,136 @@ int sim_tcp_client_socket(const char* ip)
 
     log("TCP Socket Created.\n");
     return sockfd;
+}
+
+/******************************************************************************
+ * Creates a pseudo terminal pair for simulation. The slave side is a real tty
+ * so it goes through the same termios code path as a serial radio device.
+ *
+ * @param     master  Set to the master side (the simulated radio)
+ * @param     slave   Set to the slave side (the simulated serial port)
+ *****************************************************************************/
+void sim_pty_pair(int* master, int* slave)
+{
+    if (openpty(master, slave, NULL, NULL, NULL) < 0)
+    {
+        log_error("Opening pseudo terminal");
+        exit(1);
+    }
+
+    log("Pseudo Terminal Created.\n");
+}
+
+/******************************************************************************
+ * Streams a byte pattern covering every byte value from one side of the
+ * pseudo terminal to the other and reports the throughput along with any
+ * bytes that were lost or altered on the way. Private.
+ *
+ * @param     name   The direction being measured
+ * @param     wfd    The side to write to
+ * @param     rfd    The side to read from
+ * @param     bytes  The number of bytes to send
+ *****************************************************************************/
+void sim_pty_stream(const char* name, int wfd, int rfd, int bytes)
+{
+    uint8_t buf[MAX_BUFFER_SIZE];
+    int chunk = sizeof(struct packet) - 1 + MAX_DATA_SIZE; // One full data packet
+    int sent = 0;
+    int received = 0;
+    int errors = 0;
+
+    uint64_t start = log_time_us();
+    while (received < bytes)
+    {
+        /* Queue as many packets as the terminal accepts */
+        while (sent < bytes)
+        {
+            int len = bytes - sent < chunk ? bytes - sent : chunk;
+            for (int i = 0; i < len; i++)
+            {
+                buf[i] = (uint8_t) (sent + i);
+            }
+
+            int n = write(wfd, buf, len);
+            if (n <= 0) break;
+            sent += n;
+        }
+
+        /* Drain the other side, giving up once the data stops coming */
+        struct pollfd pfd = {rfd, POLLIN, 0};
+        if (poll(&pfd, 1, 100) <= 0) break;
+
+        int n = read(rfd, buf, sizeof(buf));
+        if (n <= 0) break;
+        for (int i = 0; i < n; i++)
+        {
+            if (buf[i] != (uint8_t) (received + i)) errors++;
+        }
+        received += n;
+    }
+    uint64_t elapsed = log_time_us() - start;
+
+    log("%s: %d of %d Bytes in %d us (%.0f B/s), %d Altered.\n", name, received, bytes,
+        (int) elapsed, received * 1000000.0 / (elapsed ? elapsed : 1), errors);
+}
+
+/******************************************************************************
+ * Benchmarks the serial configuration over a pseudo terminal pair. Measures
+ * the per-byte latency from the simulated radio to the serial port and the
+ * throughput in both directions. Bytes that the configuration translates or
+ * swallows are counted so the raw mode can be compared with radio_config.
+ *
+ * @param     raw    If radio_config_raw is used instead of radio_config
+ * @param     bytes  The number of bytes to stream in each direction
+ *****************************************************************************/
+void sim_pty_benchmark(int raw, int bytes)
+{
+    int master;
+    int slave;
+    int rounds = 1000;
+    int lost = 0;
+    uint64_t total = 0;
+    uint64_t worst = 0;
+
+    /* Configure the serial side the same way as a radio device */
+    sim_pty_pair(&master, &slave);
+    if (raw)
+    {
+        radio_config_raw(slave, B115200);
+    }
+    else
+    {
+        radio_config(slave, B115200);
+    }
+    fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+    fcntl(slave, F_SETFL, fcntl(slave, F_GETFL) | O_NONBLOCK);
+
+    /* Time single bytes from the radio to the reader */
+    for (int i = 0; i < rounds; i++)
+    {
+        uint8_t byte = (uint8_t) i;
+        struct pollfd pfd = {slave, POLLIN, 0};
+
+        uint64_t start = log_time_us();
+        write(master, &byte, 1);
+        if (poll(&pfd, 1, 100) <= 0 || read(slave, &byte, 1) != 1)
+        {
+            lost++;
+            continue;
+        }
+        uint64_t elapsed = log_time_us() - start;
+
+        total += elapsed;
+        if (elapsed > worst) worst = elapsed;
+    }
+
+    log("%s Latency: %.1f us Average, %d us Worst, %d of %d Bytes Lost.\n", raw ? "Raw" : "Default",
+        rounds > lost ? (double) total / (rounds - lost) : 0.0, (int) worst, lost, rounds);
+
+    /* Stream full data packets in each direction */
+    sim_pty_stream("Radio to Serial", master, slave, bytes);
+    sim_pty_stream("Serial to Radio", slave, master, bytes);
+
+    close(slave);
+    close(master);
 }
\ No newline at end of file
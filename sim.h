@@ -10,4 +10,7 @@
 #define SIM_PORT 12345
 
 int sim_tcp_server_socket();
+int sim_tcp_server_sockets(int* fds, int count);
 int sim_tcp_client_socket(const char* ip);
+void sim_pty_pair(int* master, int* slave);
+void sim_pty_benchmark(int raw, int bytes);